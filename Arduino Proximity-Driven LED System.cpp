@@ -7,13 +7,61 @@
    Non-blocking (millis), safe indices, clean state machine.
 --------------------------- */
 
+// Output backend: where LED frames go
+#define LED_BACKEND_GPIO    0   // one digital pin per LED (ledPins[])
+#define LED_BACKEND_DMX     1   // DMX512 universe on Serial1 TX (pin 18), one slot per LED
+#define LED_BACKEND_CHARLIE 2   // charlieplexed bar on PORTA/PORTC, scanned by Timer4
+#define LED_BACKEND_MATRIX  3   // 8 x N row/column matrix, rows PORTA, columns PORTC/PORTL
+#define LED_BACKEND_595     4   // chained 74HC595 shift registers on hardware SPI
+#define LED_BACKEND_SIM     5   // framebuffer only, no hardware (host simulation)
+#define LED_BACKEND LED_BACKEND_GPIO
+
 const int ledPins[] = {31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47};
+
+#if LED_BACKEND == LED_BACKEND_CHARLIE
+// Charlieplex lines: bits 0..7 = PORTA (pins 22..29), bits 8..15 = PORTC (pins 37..30)
+const int CHARLIE_PINS          = 11;    // N lines drive N*(N-1) LEDs (11 -> 110)
+const unsigned int CHARLIE_REFRESH_HZ = 100;   // full-frame refresh rate
+const unsigned int CHARLIE_DUTY_PCT   = 100;   // % of each row slot the row is lit (brightness)
+const int numLeds = CHARLIE_PINS * (CHARLIE_PINS - 1);
+#elif LED_BACKEND == LED_BACKEND_MATRIX
+// Rows (anodes, active HIGH): PORTA pins 22..29. Columns (cathodes, active LOW):
+// bits 0..7 = PORTC (pins 37..30), bits 8..15 = PORTL (pins 49..42)
+const int MATRIX_ROWS = 8;
+const int MATRIX_COLS = 16;                    // 1..16
+const unsigned int MATRIX_REFRESH_HZ = 120;    // full-frame refresh rate
+const int numLeds = MATRIX_ROWS * MATRIX_COLS; // LED i = row i / COLS, column i % COLS
+#else
 const int numLeds = 17;
+#endif
+
+#if LED_BACKEND == LED_BACKEND_595
+// MOSI 51 -> SER, SCK 52 -> SRCLK; LED i = output i of the chain (Q0 of the first chip = LED 1)
+const int SHIFT595_LATCH_PIN = 53;   // RCLK (also SPI SS, must stay an output)
+const int SHIFT595_OE_PIN    = 12;   // /OE on a PWM pin, used for dimming
+#endif
+
+#if LED_BACKEND == LED_BACKEND_DMX
+const int DMX_START_SLOT  = 1;     // DMX address of LED 1 (slots 1..512)
+const int DMX_SLOTS       = 512;   // slots sent per frame; fewer slots = faster refresh
+const uint8_t DMX_LEVEL_ON = 255;  // dimmer level for an ON LED
+#endif
 
 const int sensor1Pin = 9;   // MASTER
 const int sensor2Pin = 11;
 const int sensor3Pin = 7;
 
+// Sensor fusion: what each logical trigger (what the FSM calls S1/S2/S3) means in terms of
+// the debounced physical sensors. Each rule is an 8-bit truth table over the sensor vector
+// (bit v set = rule true when S1..S3 read as bits 0..2 of v); build them with & | ~.
+const uint8_t SENSE_S1      = 0xAA;
+const uint8_t SENSE_S2      = 0xCC;
+const uint8_t SENSE_S3      = 0xF0;
+const uint8_t SENSE_ANY_TWO = (SENSE_S1 & SENSE_S2) | (SENSE_S1 & SENSE_S3) | (SENSE_S2 & SENSE_S3);
+const uint8_t FUSE_S1 = SENSE_S1;                  // e.g. SENSE_ANY_TWO
+const uint8_t FUSE_S2 = SENSE_S2;                  // e.g. SENSE_S2 & ~SENSE_S1
+const uint8_t FUSE_S3 = SENSE_S3;
+
 // Timing
 const unsigned long DEBOUNCE_MS      = 50;
 const unsigned long STEP_MS_MASTER   = 200;               // S1 step time
@@ -22,6 +70,231 @@ const unsigned long HOLD_DURATION_MS = 30UL * 1000UL;     // S2/S3 hold (30s)
 const unsigned long HOLD_S1_MS       = 30UL * 1000UL;     // S1 hold (30s)
 const unsigned long S1_TOP_DWELL_MS  = STEP_MS_MASTER;    // brief dwell at "all ON" so LED 17 is visibly on
 
+// Sweep timing profile: per-step intervals from PROGMEM tables (see stepMsMaster/stepMsS2S3)
+#define PROFILE_LINEAR      0   // constant STEP_MS_* (original behavior)
+#define PROFILE_ACCEL       1   // start slow, finish fast
+#define PROFILE_DECEL       2   // start fast, finish slow
+#define PROFILE_EASE_IN_OUT 3   // slow at both ends, fast in the middle
+#define SWEEP_PROFILE PROFILE_LINEAR
+const unsigned int EASE_SCALE_PCT = 100;                  // scales a whole eased sweep (e.g. 70 = 30% shorter)
+
+#if SWEEP_PROFILE != PROFILE_LINEAR
+// Eased step tables: the curve is EASE_POINTS intervals in % of the linear step; it is
+// resampled to one entry per LED and expanded to milliseconds at compile time, so a
+// step costs one pgm_read_word() with no index math.
+const int EASE_POINTS = 32;
+#define EP(s, pct) (uint16_t)((s) * (pct) * EASE_SCALE_PCT / 10000UL > 0 ? (s) * (pct) * EASE_SCALE_PCT / 10000UL : 1)
+constexpr uint8_t EASE_PCT[EASE_POINTS] = {
+#if SWEEP_PROFILE == PROFILE_ACCEL
+  200, 190, 180, 171, 161, 153, 144, 136, 128, 121, 113, 107, 100, 94, 88, 83,
+  77, 73, 68, 64, 60, 57, 53, 51, 48, 46, 44, 43, 41, 41, 40, 40
+#elif SWEEP_PROFILE == PROFILE_DECEL
+  40, 40, 41, 41, 43, 44, 46, 48, 51, 53, 57, 60, 64, 68, 73, 77,
+  83, 88, 94, 100, 107, 113, 121, 128, 136, 144, 153, 161, 171, 180, 190, 200
+#else
+  200, 180, 161, 144, 128, 113, 100, 88, 77, 68, 60, 53, 48, 44, 41, 40,
+  40, 41, 44, 48, 53, 60, 68, 77, 88, 100, 113, 128, 144, 161, 180, 200
+#endif
+};
+
+constexpr uint16_t easeStepMs(unsigned long s, int stepNo) {
+  return EP(s, EASE_PCT[stepNo * EASE_POINTS / numLeds]);
+}
+
+// EaseSeq<0, 1, ..., numLeds - 1> expands a table to one initializer per LED
+template <int... I> struct EaseSeq {};
+template <int N, int... I> struct MakeEaseSeq : MakeEaseSeq<N - 1, N - 1, I...> {};
+template <int... I> struct MakeEaseSeq<0, I...> { typedef EaseSeq<I...> type; };
+
+struct EaseTable {
+  uint16_t ms[numLeds];
+};
+
+template <int... I>
+constexpr EaseTable makeEaseTable(unsigned long s, EaseSeq<I...>) {
+  return EaseTable{{ easeStepMs(s, I)... }};
+}
+
+constexpr EaseTable EASE_MASTER PROGMEM = makeEaseTable(STEP_MS_MASTER, MakeEaseSeq<numLeds>::type());
+constexpr EaseTable EASE_S2S3 PROGMEM   = makeEaseTable(STEP_MS_S2_S3, MakeEaseSeq<numLeds>::type());
+#endif
+
+// Hold-expiry warning (1 = dim or breathe the bar during the last HOLD_WARN_MS of a hold;
+// a retrigger then just extends the hold, S1 included, instead of restarting the sweep)
+#define HOLD_WARNING 0
+#define WARN_DIM_DOWN 0
+#define WARN_BREATHE  1
+#define HOLD_WARN_STYLE WARN_DIM_DOWN
+const unsigned long HOLD_WARN_MS       = 5000;
+const uint8_t       HOLD_WARN_MIN_LEVEL = 40;             // 0..255, dimmest point
+const unsigned long HOLD_WARN_BREATHE_MS = 1000;          // breathe period
+
+// Gestures on the debounced sensors (1 = double-tap GESTURE_LATCH_SENSOR toggles a latch that
+// keeps the bar ON; holding GESTURE_OFF_SENSOR for LONG_HOLD_MS forces everything OFF)
+#define GESTURES 0
+const uint8_t       GESTURE_LATCH_SENSOR = 1;             // 0..2 = S1..S3 (default S2)
+const uint8_t       GESTURE_OFF_SENSOR   = 2;             // default S3
+const unsigned int  TAP_MAX_MS           = 400;           // press shorter than this = tap
+const unsigned int  DOUBLE_TAP_GAP_MS    = 400;           // max release between the two taps
+const unsigned int  LONG_HOLD_MS         = 5000;
+
+// Time-of-day schedule from a DS3231-class RTC on I2C (SDA 20 / SCL 21). The RTC is read
+// once a minute; SCHEDULE picks the day phase, whose DAY_PHASES entry scales holds and
+// step speed and sets brightness.
+#define RTC_SCHEDULE 0
+const uint8_t       RTC_I2C_ADDR     = 0x68;
+const unsigned long RTC_POLL_MS      = 60000UL;
+const unsigned long RTC_TIMEOUT_MS   = 50;                // a read not done by then is abandoned
+
+enum DayPhaseId : uint8_t { PHASE_DAY, PHASE_EVENING, PHASE_NIGHT };
+
+struct DayPhase {
+  uint8_t  holdScale16;    // S1 and S2/S3 hold x holdScale16 / 16 (16 = configured/learned hold)
+  uint8_t  stepScale16;    // step interval x stepScale16 / 16 (16 = as configured above)
+  uint8_t  level;          // bar brightness 0..255
+};
+
+const DayPhase DAY_PHASES[] = {
+  /* PHASE_DAY     */ {16, 16, 255},
+  /* PHASE_EVENING */ {16, 16, 160},
+  /* PHASE_NIGHT   */ { 5, 24,  60},
+};
+
+struct ScheduleEntry {
+  uint16_t startMinute;    // minute of day the phase begins, ascending
+  uint8_t  phase;
+};
+
+const ScheduleEntry SCHEDULE[] = {
+  {0,       PHASE_NIGHT},
+  {6 * 60,  PHASE_DAY},
+  {19 * 60, PHASE_EVENING},
+  {23 * 60, PHASE_NIGHT},
+};
+
+// Fixed-rate sensor sampling (1 = Timer2 ISR samples all sensors at 1 kHz; a 5-sample majority
+// vote feeds a per-channel integrator that replaces debounceRead())
+#define ISR_SAMPLER 0
+
+// Fast start (1 = first LED of a triggered sweep lights after FIRST_STEP_LEAD_MS instead of a
+// full step period, and sensors count as HIGH after DEBOUNCE_RISE_MS; release still uses DEBOUNCE_MS)
+#define FAST_START 0
+const unsigned long FIRST_STEP_LEAD_MS = 0;               // 0 = light LED 1 in the triggering pass
+const unsigned long DEBOUNCE_RISE_MS   = 20;
+
+// Hold auto-tuning (1 = adapt hold lengths to observed retrigger gaps, 0 = fixed holds above)
+#define AUTO_HOLD_TUNING 0
+const unsigned long HOLD_MIN_MS       = 5UL * 1000UL;     // never hold shorter than this
+const unsigned long HOLD_MAX_MS       = 120UL * 1000UL;   // never hold longer than this
+const unsigned int  HOLD_PERCENTILE   = 90;               // hold covers this % of inter-trigger gaps
+const unsigned int  HOLD_MIN_SAMPLES  = 16;               // keep fixed holds until this many gaps seen
+
+// Modbus RTU slave for BMS integration (1 = on Serial2 pins 16/17 + RS-485 driver)
+#define MODBUS_SLAVE 0
+const uint8_t       MODBUS_ADDRESS    = 1;                // slave id (1..247)
+const unsigned long MODBUS_BAUD       = 19200;            // 8E1
+const int           MODBUS_DE_PIN     = 2;                // RS-485 driver enable (HIGH = transmit)
+
+// Binary telemetry frames on Serial (USB), see telemetrySend()
+#define TELEMETRY 0
+const unsigned long SERIAL_BAUD       = 115200;           // Serial (USB): telemetry out, config in
+const unsigned long STATUS_REPORT_MS  = 1000;             // STATUS frame period
+const uint8_t       CONTROLLER_ID     = 1;                // identifies this unit in STATUS frames
+
+// Change trace over telemetry (1 = stream (dt, state, currentLed, sensors) records on change)
+#define TRACE 0
+const unsigned long TRACE_FLUSH_MS    = 250;              // max age of a buffered record
+
+// Config hot reload over Serial (1 = accept CRC-checked config frames, applied between steps)
+#define CONFIG_RELOAD 0
+const uint8_t       CONFIG_VERSION    = 1;
+const uint8_t       SERIAL_RX_PER_LOOP = 8;               // max Serial bytes parsed per loop()
+const uint16_t      CFG_STEP_MS_MAX   = 5000;             // accepted ranges; frames outside are rejected
+const uint16_t      CFG_DWELL_MS_MAX  = 10000;
+const uint16_t      CFG_DEBOUNCE_MS_MAX = 255;            // ISR_SAMPLER integrator limit
+const uint16_t      CFG_HOLD_SEC_MAX  = 3600;
+
+// 24 h activity history (1 = per-minute summaries for the last hour, rolled up into
+// per-hour summaries for the last day; sent as HISTORY frames when 'H' arrives on Serial)
+#define HISTORY 0
+const uint8_t       HISTORY_REQ       = 'H';
+#if HISTORY && !TELEMETRY
+#error "HISTORY sends its dump as telemetry frames: enable TELEMETRY"
+#endif
+
+// Stack/RAM high-water mark (1 = paint stack at boot, scan in slices, report via telemetry)
+#define MEMORY_STATS 0
+const unsigned int  STACK_SCAN_BYTES  = 16;               // bytes checked per loop() pass
+const unsigned long MEMORY_REPORT_MS  = 5000;             // MEMORY frame period
+#if MEMORY_STATS && !TELEMETRY
+#error "MEMORY_STATS reports through MEMORY telemetry frames: enable TELEMETRY"
+#endif
+
+// Sensor-to-light latency measurement (1 = Timer5 edge sampler + histogram, reported via telemetry)
+#define LATENCY_MEASURE 0
+const unsigned int  LATENCY_SAMPLE_HZ = 2000;             // raw edge sampling rate (timestamp resolution)
+const unsigned long LATENCY_TIMEOUT_MS = 1000;            // edges with no LED after this are discarded
+const unsigned long LATENCY_REPORT_MS = 10000;            // LATENCY frame period
+#if LATENCY_MEASURE && !TELEMETRY
+#error "LATENCY_MEASURE reports through LATENCY telemetry frames: enable TELEMETRY"
+#endif
+
+// How loop() reaches the handler for the current state (same handlers in every variant)
+#define FSM_DISPATCH_IF     0   // compare chain, S1 states first
+#define FSM_DISPATCH_SWITCH 1   // switch on the dense State enum: one bounds check + jump table
+#define FSM_DISPATCH_TABLE  2   // PROGMEM table of handler pointers, one indirect call
+#define FSM_DISPATCH FSM_DISPATCH_TABLE   // fastest in 10 of 13 states (host/dispatch_bench)
+
+// ------------- Time units -------------
+// millis() arithmetic with types: Ms is a duration, MsTime a point on the wrapping
+// millis() clock. A time point can't stand in for a duration, and two time points can
+// only be subtracted, never ordered, since `<` is wrong across the 49.7-day wrap.
+// `now - start >= interval` keeps its usual wrap-safe meaning. Both are one
+// unsigned long with constexpr inline operators, so they compile to the same code as
+// the raw arithmetic.
+struct Ms {
+  unsigned long count;
+  constexpr Ms() : count(0) {}
+  constexpr explicit Ms(unsigned long ms) : count(ms) {}
+  constexpr Ms operator+(Ms d) const { return Ms(count + d.count); }
+  constexpr Ms operator-(Ms d) const { return Ms(count - d.count); }
+  constexpr bool operator<(Ms d) const  { return count < d.count; }
+  constexpr bool operator<=(Ms d) const { return count <= d.count; }
+  constexpr bool operator>(Ms d) const  { return count > d.count; }
+  constexpr bool operator>=(Ms d) const { return count >= d.count; }
+  constexpr bool operator==(Ms d) const { return count == d.count; }
+  constexpr bool operator!=(Ms d) const { return count != d.count; }
+};
+
+constexpr Ms seconds(unsigned long s) {
+  return Ms(s * 1000UL);
+}
+
+struct MsTime {
+  unsigned long ticks;
+  constexpr MsTime() : ticks(0) {}
+  constexpr explicit MsTime(unsigned long t) : ticks(t) {}
+  constexpr Ms operator-(MsTime earlier) const { return Ms(ticks - earlier.ticks); }
+  constexpr MsTime operator+(Ms d) const { return MsTime(ticks + d.count); }
+  constexpr MsTime operator-(Ms d) const { return MsTime(ticks - d.count); }
+};
+
+// Narrowest unsigned type holding MAX
+template <bool B, typename T, typename F> struct TypeIf { typedef T type; };
+template <typename T, typename F> struct TypeIf<false, T, F> { typedef F type; };
+template <unsigned long MAX> struct UintFor {
+  typedef typename TypeIf<(MAX <= 0xFFUL), uint8_t,
+          typename TypeIf<(MAX <= 0xFFFFUL), uint16_t, unsigned long>::type>::type type;
+};
+
+// A duration stored in the narrowest type that holds MAX ms, for RAM-resident settings;
+// reads widen to Ms
+template <unsigned long MAX> struct MsField {
+  typename UintFor<MAX>::type count;
+  constexpr MsField(Ms d) : count(d.count) {}
+  constexpr operator Ms() const { return Ms(count); }
+};
+
 // State machine
 enum State {
   IDLE,
@@ -48,287 +321,2194 @@ enum State {
 State state = IDLE;
 
 // Sequencing
-int currentLed = 0;                // index into ledPins (0..16)
-unsigned long lastStepTime = 0;    // last time we stepped an LED
-unsigned long holdStartTime = 0;   // when we started a hold
+int currentLed = 0;                // LED index (0..numLeds-1)
+MsTime lastStepTime;               // last time we stepped an LED
+MsTime holdStartTime;              // when we started a hold
+
+// Hold lengths. Each source owns its own value and holdRecompute() composes them into
+// the active holds: CONFIG_RELOAD sets the base, AUTO_HOLD_TUNING replaces it once it
+// has HOLD_MIN_SAMPLES gaps, and the RTC_SCHEDULE day phase scales the result.
+Ms holdS2S3BaseMs = Ms(HOLD_DURATION_MS);
+Ms holdS1BaseMs   = Ms(HOLD_S1_MS);
+#if AUTO_HOLD_TUNING
+Ms holdLearnedMs;                  // 0 until enough gaps are seen
+#endif
+Ms holdS2S3Ms = Ms(HOLD_DURATION_MS);
+Ms holdS1Ms   = Ms(HOLD_S1_MS);
+
+// Active step/dwell/debounce timing (fixed unless CONFIG_RELOAD replaces them)
+unsigned long stepMsMasterCfg = STEP_MS_MASTER;
+unsigned long stepMsS2S3Cfg   = STEP_MS_S2_S3;
+MsField<0xFFFF> s1TopDwellMs  = Ms(S1_TOP_DWELL_MS);  // CONFIG_RELOAD sends it as uint16_t
+unsigned long debounceMs      = DEBOUNCE_MS;
+
+// Day-phase overrides (fixed unless RTC_SCHEDULE changes them)
+uint8_t stepScale16 = 16;
+uint8_t holdScale16 = 16;
+uint8_t dayLevel    = 255;
+
+#if MODBUS_SLAVE
+// BMS override written through Modbus register 10
+enum ForceMode { FORCE_AUTO = 0, FORCE_OFF = 1, FORCE_ON = 2 };
+ForceMode forceMode = FORCE_AUTO;
+#endif
+
+// Framebuffer: bit (i & 7) of ledFrame[i >> 3] set = LED i ON
+uint8_t ledFrame[(numLeds + 7) / 8];
 
 // Master release handling
 bool s1Released = false;           // sensor1 went LOW while S1 was running
+#if HOLD_WARNING
+bool s1HoldExtend = false;         // S1 retriggered during the warning: keep extending the hold
+#endif
 
 // Debounce storage
 int  s1Stable = LOW, s2Stable = LOW, s3Stable = LOW;
 int  s1LastRead = LOW, s2LastRead = LOW, s3LastRead = LOW;
 unsigned long s1LastChange = 0, s2LastChange = 0, s3LastChange = 0;
 
+// Debounced edges and counters
+uint8_t sensorVec  = 0;            // bit n = sensor n+1 stable HIGH
+uint8_t sensorRose = 0;            // bit n = sensor n+1 went HIGH this pass
+uint16_t triggerCount[3] = {0, 0, 0};
+
+// Sensor input ports/masks, cached once in setup() for the lazy debounce, the Timer2
+// sampler and the Timer5 latency sampler
+volatile uint8_t *sensorPinReg[3];
+uint8_t sensorPinMask[3];
+
+void sensorPinsBegin() {
+  const int pins[3] = {sensor1Pin, sensor2Pin, sensor3Pin};
+  for (int i = 0; i < 3; i++) {
+    sensorPinReg[i]  = portInputRegister(digitalPinToPort(pins[i]));
+    sensorPinMask[i] = digitalPinToBitMask(pins[i]);
+  }
+}
+
+// Raw pin levels packed as bit n = sensor n+1
+inline uint8_t sensorRawVec() {
+  uint8_t raw = 0;
+  for (uint8_t i = 0; i < 3; i++) {
+    if (*sensorPinReg[i] & sensorPinMask[i]) raw |= 1 << i;
+  }
+  return raw;
+}
+
+#if TELEMETRY
+// ------------- Telemetry -------------
+// Frame: 0xA5, type, len, payload[len], sum (8-bit sum of type, len, payload).
+// Frames are dropped, never queued, when the Serial TX buffer lacks room, so
+// telemetry can never block loop().
+enum TelemetryType : uint8_t {
+  TLM_MEMORY = 1,
+  TLM_LATENCY = 2,
+  TLM_CONFIG_ACK = 3,
+  TLM_STATUS = 4,
+  TLM_TRACE = 5,
+  TLM_HISTORY = 6,
+};
+
+const uint8_t TLM_SYNC = 0xA5;
+
+bool telemetrySend(uint8_t type, const void *payload, uint8_t len) {
+  if (Serial.availableForWrite() < len + 4) return false;
+  const uint8_t *p = (const uint8_t *)payload;
+  uint8_t sum = type + len;
+  for (uint8_t i = 0; i < len; i++) sum += p[i];
+  Serial.write(TLM_SYNC);
+  Serial.write(type);
+  Serial.write(len);
+  Serial.write(p, len);
+  Serial.write(sum);
+  return true;
+}
+#endif
+
+#if MEMORY_STATS
+// ------------- Stack / RAM high-water mark -------------
+// setup() paints the free gap between heap end and the stack with STACK_CANARY.
+// Each loop() checks STACK_SCAN_BYTES more of it, bottom-up; the lowest overwritten
+// byte is the deepest the stack has reached. The scan only covers the part below
+// the current mark, since the mark can only move down.
+extern char __data_start, __data_end, __bss_start, __bss_end, __heap_start;
+extern char *__brkval;
+
+const uint8_t STACK_CANARY = 0xC5;
+
+struct MemoryStats {
+  uint16_t stackFreeMin;   // bytes never touched by the stack since boot
+  uint16_t dataSize;
+  uint16_t bssSize;
+  uint16_t isrStackFreeMin; // free bytes below the lowest SP seen on ISR entry
+};
+
+uint8_t *stackBottom;      // first byte above heap/.bss
+uint8_t *stackMark;        // lowest byte the stack has touched
+uint8_t *stackScan;
+unsigned long lastMemoryReport = 0;
+uint8_t * volatile isrSpMin;
+
+// ISRs never nest here (none is ISR_NOBLOCK), so the useful figure is how deep the
+// interrupted code already was: the lowest SP seen on entry, after the ISR prologue.
+#define ISR_ENTER() do { uint8_t *sp = (uint8_t *)SP; if (sp < isrSpMin) isrSpMin = sp; } while (0)
+
+void stackPaint() {
+  stackBottom = (uint8_t *)(__brkval ? __brkval : &__heap_start);
+  stackMark   = (uint8_t *)SP - 16;              // leave setup()'s own frame alone
+  for (uint8_t *p = stackBottom; p < stackMark; p++) *p = STACK_CANARY;
+  stackScan = stackBottom;
+  isrSpMin = stackMark;
+}
+
+void stackScanStep() {
+  for (unsigned int n = 0; n < STACK_SCAN_BYTES && stackScan < stackMark; n++, stackScan++) {
+    if (*stackScan != STACK_CANARY) {
+      stackMark = stackScan;
+      break;
+    }
+  }
+  if (stackScan >= stackMark) stackScan = stackBottom;
+}
+
+void memoryReport(unsigned long now) {
+  if (now - lastMemoryReport < MEMORY_REPORT_MS) return;
+  lastMemoryReport = now;
+  MemoryStats m;
+  m.stackFreeMin = stackMark - stackBottom;
+  m.dataSize     = &__data_end - &__data_start;
+  m.bssSize      = &__bss_end - &__bss_start;
+  noInterrupts();
+  m.isrStackFreeMin = isrSpMin - stackBottom;
+  interrupts();
+#if TELEMETRY
+  telemetrySend(TLM_MEMORY, &m, sizeof(m));
+#endif
+}
+#else
+#define ISR_ENTER() do {} while (0)
+#endif
+
+#if LED_BACKEND == LED_BACKEND_DMX
+// ------------- DMX512 output (USART1) -------------
+// Frame = BREAK, MAB, start code 0, then DMX_SLOTS slots at 250 kbaud 8N2.
+// BREAK/MAB come from sending 0x00 at 50 kbaud: 9 low bits = 180us BREAK,
+// 2 stop bits = 40us MAB. Everything runs from the TX interrupts, so the
+// universe refreshes continuously (~43 Hz at 512 slots) without loop() involvement.
+// Note: do not use Serial1 when this backend is selected (it owns USART1).
+const uint16_t DMX_UBRR_DATA  = F_CPU / 16 / 250000UL - 1;
+const uint16_t DMX_UBRR_BREAK = F_CPU / 16 / 50000UL - 1;
+
+enum DmxPhase : uint8_t { DMX_BREAK, DMX_DATA, DMX_LAST };
+
+uint8_t dmxBuf[DMX_SLOTS];           // slot 1 is dmxBuf[0]
+volatile uint8_t dmxPhase = DMX_BREAK;
+volatile uint16_t dmxSlot = 0;
+
+void dmxSendBreak() {
+  UBRR1 = DMX_UBRR_BREAK;
+  dmxPhase = DMX_BREAK;
+  UDR1 = 0;
+}
+
+void dmxBegin() {
+  UCSR1A = 0;
+  UCSR1C = _BV(USBS1) | _BV(UCSZ11) | _BV(UCSZ10);   // 8N2
+  UCSR1B = _BV(TXEN1) | _BV(TXCIE1);
+  dmxSendBreak();
+}
+
+// Transmitter fully idle: end of BREAK or end of the last slot
+ISR(USART1_TX_vect) {
+  ISR_ENTER();
+  if (dmxPhase == DMX_BREAK) {
+    UBRR1 = DMX_UBRR_DATA;
+    dmxPhase = DMX_DATA;
+    dmxSlot = 0;
+    UDR1 = 0;                        // start code
+    UCSR1B |= _BV(UDRIE1);
+  } else if (dmxPhase == DMX_LAST) {
+    dmxSendBreak();
+  }
+  // DMX_DATA: a late UDRE refill let the shifter drain; the UDRE ISR carries on
+}
+
+// Data register empty: feed the next slot
+ISR(USART1_UDRE_vect) {
+  ISR_ENTER();
+  UDR1 = dmxBuf[dmxSlot++];
+  if (dmxSlot >= DMX_SLOTS) {
+    UCSR1B &= ~_BV(UDRIE1);
+    dmxPhase = DMX_LAST;
+  }
+}
+
+static_assert(DMX_START_SLOT >= 1 && DMX_START_SLOT - 1 + numLeds <= DMX_SLOTS, "LEDs must fit in the DMX frame");
+
+uint8_t dmxLevel = DMX_LEVEL_ON;      // current level for ON slots (dimmed by the hold warning)
+
+inline void dmxSetLed(int idx, bool on) {
+  dmxBuf[DMX_START_SLOT - 1 + idx] = on ? dmxLevel : 0;
+}
+#endif
+
+#if LED_BACKEND == LED_BACKEND_CHARLIE
+// ------------- Charlieplexed output (Timer4) -------------
+// Row r = line r driven HIGH as anode; LED (r, c) lights when line c is driven LOW.
+// All other lines are tri-stated. Each row keeps its precomputed DDR/PORT bytes,
+// so the ISR is five port writes per tick regardless of how many LEDs are lit.
+// COMPA starts the next row, COMPB blanks it early to set the duty cycle.
+// LED i -> row i / (N-1), column = k < row ? k : k + 1 with k = i % (N-1).
+static_assert(CHARLIE_PINS >= 2 && CHARLIE_PINS <= 16, "charlieplex lines must fit PORTA+PORTC");
+
+const uint16_t CHARLIE_OCR_ROW   = F_CPU / 8 / ((unsigned long)CHARLIE_REFRESH_HZ * CHARLIE_PINS) - 1;  // clk/8
+const uint16_t CHARLIE_OCR_BLANK = (unsigned long)CHARLIE_OCR_ROW * CHARLIE_DUTY_PCT / 100;
+
+uint8_t charlieDdrA[CHARLIE_PINS], charlieDdrC[CHARLIE_PINS];    // anode + lit cathodes
+uint8_t charliePortA[CHARLIE_PINS], charliePortC[CHARLIE_PINS];  // anode only
+volatile uint8_t charlieRow = 0;
+
+void charlieBegin() {
+  DDRA = 0; DDRC = 0; PORTA = 0; PORTC = 0;
+  for (int r = 0; r < CHARLIE_PINS; r++) {
+    uint16_t anode = 1U << r;
+    charliePortA[r] = charlieDdrA[r] = anode & 0xFF;
+    charliePortC[r] = charlieDdrC[r] = anode >> 8;
+  }
+  TCCR4A = 0;
+  TCCR4B = _BV(WGM42) | _BV(CS41);               // CTC, clk/8
+  OCR4A  = CHARLIE_OCR_ROW;
+  OCR4B  = CHARLIE_OCR_BLANK;
+  TIMSK4 = _BV(OCIE4A) | (CHARLIE_DUTY_PCT < 100 ? _BV(OCIE4B) : 0);
+}
+
+ISR(TIMER4_COMPA_vect) {
+  ISR_ENTER();
+  uint8_t r = charlieRow;
+  DDRA = 0; DDRC = 0;                            // tri-state before moving the anode
+  PORTA = charliePortA[r]; PORTC = charliePortC[r];
+  DDRA = charlieDdrA[r];   DDRC = charlieDdrC[r];
+  charlieRow = (r + 1 < CHARLIE_PINS) ? r + 1 : 0;
+}
+
+ISR(TIMER4_COMPB_vect) {
+  ISR_ENTER();
+  DDRA = 0; DDRC = 0;
+}
+
+inline void charlieSetLed(int idx, bool on) {
+  int row = idx / (CHARLIE_PINS - 1);
+  int col = idx % (CHARLIE_PINS - 1);
+  if (col >= row) col++;
+  uint8_t *ddr = (col < 8) ? &charlieDdrA[row] : &charlieDdrC[row];
+  uint8_t bit = 1 << (col & 7);
+  if (on) *ddr |= bit;                           // single byte store: atomic w.r.t. the ISR
+  else    *ddr &= ~bit;
+}
+#endif
+
+#if LED_BACKEND == LED_BACKEND_MATRIX
+// ------------- Row/column matrix output (Timer4) -------------
+// The bitplane is stored row-major as the column port bytes themselves (bit clear =
+// LED lit, since columns sink), so a sweep step flips exactly one bit and the ISR
+// just copies two bytes out per row with no per-tick translation.
+static_assert(MATRIX_COLS >= 1 && MATRIX_COLS <= 16, "matrix columns must fit PORTC+PORTL");
+
+const uint16_t MATRIX_OCR_ROW = F_CPU / 8 / ((unsigned long)MATRIX_REFRESH_HZ * MATRIX_ROWS) - 1;  // clk/8
+
+uint8_t matrixColC[MATRIX_ROWS], matrixColL[MATRIX_ROWS];
+volatile uint8_t matrixRow = 0;
+
+void matrixBegin() {
+  for (int r = 0; r < MATRIX_ROWS; r++) {
+    matrixColC[r] = 0xFF;
+    matrixColL[r] = 0xFF;
+  }
+  PORTA = 0;    DDRA = 0xFF;
+  PORTC = 0xFF; DDRC = 0xFF;
+  PORTL = 0xFF; DDRL = 0xFF;
+  TCCR4A = 0;
+  TCCR4B = _BV(WGM42) | _BV(CS41);               // CTC, clk/8
+  OCR4A  = MATRIX_OCR_ROW;
+  TIMSK4 = _BV(OCIE4A);
+}
+
+ISR(TIMER4_COMPA_vect) {
+  ISR_ENTER();
+  uint8_t r = matrixRow;
+  PORTA = 0;                                     // blank while columns change
+  PORTC = matrixColC[r];
+  PORTL = matrixColL[r];
+  PORTA = 1 << r;
+  matrixRow = (r + 1) & (MATRIX_ROWS - 1);
+}
+
+// Early row blank, only enabled while dimmed
+ISR(TIMER4_COMPB_vect) {
+  ISR_ENTER();
+  PORTA = 0;
+}
+
+inline void matrixSetLed(int idx, bool on) {
+  int row = idx / MATRIX_COLS;
+  int col = idx % MATRIX_COLS;
+  uint8_t *cols = (col < 8) ? &matrixColC[row] : &matrixColL[row];
+  uint8_t bit = 1 << (col & 7);
+  if (on) *cols &= ~bit;
+  else    *cols |= bit;
+}
+#endif
+
+#if LATENCY_MEASURE
+// ------------- Sensor-to-light latency -------------
+// Timer5 samples the raw sensor pins at LATENCY_SAMPLE_HZ and timestamps the first
+// rising edge that should start a sequence (any S1 edge outside a running S1, S2/S3
+// edges only from IDLE). The next LED switched ON closes the measurement. Samples go
+// into a fixed histogram of LAT_BUCKET_US-wide buckets; the last one catches overflow.
+// latencyEdge() is the single entry point for edges, so a host build can inject
+// them directly as a simulated loopback.
+const int LAT_BUCKETS = 64;
+const unsigned long LAT_BUCKET_US = 2000;        // 0..126 ms in 2 ms steps, then overflow
+
+struct LatencyStats {
+  uint16_t count;
+  uint16_t p50Ms, p90Ms, p99Ms, maxMs;
+};
+
+uint16_t latHist[LAT_BUCKETS];
+uint16_t latCount = 0;
+unsigned long latMaxUs = 0;
+volatile unsigned long latEdgeUs = 0;
+volatile bool latPending = false;
+unsigned long lastLatencyReport = 0;
+
+uint8_t latRawPrev = 0;
+
+void latencyEdge(uint8_t sensorBit, unsigned long us) {
+  if (latPending) return;
+  bool s1Running = (state == S1_SWEEP_ON || state == S1_PEAK_DWELL || state == S1_OFF_INSTANT);
+  if ((sensorBit == 0x01 && !s1Running) || state == IDLE) {
+    latEdgeUs = us;
+    latPending = true;
+  }
+}
+
+ISR(TIMER5_COMPA_vect) {
+  ISR_ENTER();
+  uint8_t raw = sensorRawVec();
+  uint8_t rose = raw & ~latRawPrev;
+  latRawPrev = raw;
+  if (rose) latencyEdge(rose & 0x01 ? 0x01 : rose, micros());
+}
+
+void latencyBegin() {
+  TCCR5A = 0;
+  TCCR5B = _BV(WGM52) | _BV(CS51);               // CTC, clk/8
+  OCR5A  = F_CPU / 8 / LATENCY_SAMPLE_HZ - 1;
+  TIMSK5 = _BV(OCIE5A);
+}
+
+// First LED ON after an armed edge
+inline void latencyLedOn() {
+  if (!latPending) return;
+  unsigned long us = micros() - latEdgeUs;
+  latPending = false;
+  unsigned long b = us / LAT_BUCKET_US;
+  if (b >= LAT_BUCKETS) b = LAT_BUCKETS - 1;
+  if (latHist[b] < 0xFFFF) latHist[b]++;
+  if (latCount < 0xFFFF) latCount++;
+  if (us > latMaxUs) latMaxUs = us;
+}
+
+// Upper edge (ms) of the bucket holding the pct-th percentile
+uint16_t latencyPercentileMs(uint8_t pct) {
+  unsigned long target = ((unsigned long)latCount * pct + 99) / 100;
+  unsigned long seen = 0;
+  int b = 0;
+  for (; b < LAT_BUCKETS - 1; b++) {
+    seen += latHist[b];
+    if (seen >= target) break;
+  }
+  return (uint16_t)((b + 1) * LAT_BUCKET_US / 1000);
+}
+
+void latencyUpdate(unsigned long now) {
+  if (latPending) {
+    noInterrupts();
+    unsigned long edgeUs = latEdgeUs;
+    interrupts();
+    if (micros() - edgeUs > LATENCY_TIMEOUT_MS * 1000UL) latPending = false;  // glitch, never lit
+  }
+  if (now - lastLatencyReport < LATENCY_REPORT_MS) return;
+  lastLatencyReport = now;
+  if (latCount == 0) return;
+  LatencyStats l;
+  l.count = latCount;
+  l.p50Ms = latencyPercentileMs(50);
+  l.p90Ms = latencyPercentileMs(90);
+  l.p99Ms = latencyPercentileMs(99);
+  l.maxMs = (uint16_t)(latMaxUs / 1000UL);
+#if TELEMETRY
+  telemetrySend(TLM_LATENCY, &l, sizeof(l));
+#endif
+}
+#endif
+
+// ------------- Output policies -------------
+// Each backend is a struct of static functions with the same shape:
+//   begin()          set up pins/peripherals, all LEDs off
+//   set(idx, on)     push one framebuffer change (ledFrame is already updated)
+//   setLevel(level)  dim every lit LED, 255 = full, using the backend's cheapest method
+//   service()        per-loop() work (software PWM, deferred frame flush), usually nothing
+// LedOutput names the one selected by LED_BACKEND, so the sequencer is compiled against
+// it directly: every call is resolved at compile time and inlines, with no dispatch.
+#if LED_BACKEND == LED_BACKEND_GPIO
+// Port register + bit per LED, looked up once, so a write is a masked port update.
+// Pins 31..47 have no hardware PWM, so dimming is software PWM run from service().
+volatile uint8_t *gpioPort[numLeds];
+uint8_t gpioMask[numLeds];
+uint8_t gpioLevel = 255;
+bool gpioLit = true;               // PWM phase: false = bar blanked
+
+inline void gpioWrite(int idx, bool high) {
+  uint8_t sreg = SREG;
+  noInterrupts();                  // ports H..L are not bit-addressable: keep the RMW atomic
+  if (high) *gpioPort[idx] |= gpioMask[idx];
+  else      *gpioPort[idx] &= ~gpioMask[idx];
+  SREG = sreg;
+}
+
+struct GpioOutput {
+  static void begin() {
+    for (int i = 0; i < numLeds; i++) {
+      pinMode(ledPins[i], OUTPUT);
+      digitalWrite(ledPins[i], LOW);
+      gpioPort[i] = portOutputRegister(digitalPinToPort(ledPins[i]));
+      gpioMask[i] = digitalPinToBitMask(ledPins[i]);
+    }
+  }
+  static inline void set(int idx, bool on) {
+    gpioWrite(idx, on && gpioLit);
+  }
+  static void show(bool lit) {
+    gpioLit = lit;
+    for (int i = 0; i < numLeds; i++) {
+      gpioWrite(i, lit && (ledFrame[i >> 3] & (1 << (i & 7))));
+    }
+  }
+  static void setLevel(uint8_t level) {
+    if (level == gpioLevel) return;
+    gpioLevel = level;
+    if (level == 255 && !gpioLit) show(true);
+  }
+  // 8.192 ms PWM period from micros(), so no division in the per-loop check
+  static inline void service() {
+    if (gpioLevel == 255) return;
+    bool lit = (micros() & 8191) < ((unsigned int)gpioLevel << 5);
+    if (lit != gpioLit) show(lit);
+  }
+};
+typedef GpioOutput LedOutput;
+
+#elif LED_BACKEND == LED_BACKEND_595
+// set() only marks the frame dirty; service() shifts the whole chain (one SPI byte per
+// 8 LEDs at 8 MHz) and latches once per loop(), so a burst of changes costs one frame.
+// Dimming is hardware PWM on /OE.
+bool shiftDirty = true;
+
+struct Shift595Output {
+  static void begin() {
+    pinMode(SHIFT595_LATCH_PIN, OUTPUT);
+    digitalWrite(SHIFT595_LATCH_PIN, LOW);
+    pinMode(SHIFT595_OE_PIN, OUTPUT);
+    digitalWrite(SHIFT595_OE_PIN, LOW);          // outputs enabled
+    pinMode(51, OUTPUT);                         // MOSI
+    pinMode(52, OUTPUT);                         // SCK
+    SPCR = _BV(SPE) | _BV(MSTR);                 // mode 0, MSB first
+    SPSR = _BV(SPI2X);                           // clk/2 = 8 MHz
+    service();
+  }
+  static inline void set(int, bool) {
+    shiftDirty = true;
+  }
+  static void setLevel(uint8_t level) {
+    analogWrite(SHIFT595_OE_PIN, 255 - level);   // /OE is active low
+  }
+  static inline void service() {
+    if (!shiftDirty) return;
+    shiftDirty = false;
+    for (int b = sizeof(ledFrame) - 1; b >= 0; b--) {   // last chip first
+      SPDR = ledFrame[b];
+      while (!(SPSR & _BV(SPIF))) {}
+    }
+    digitalWrite(SHIFT595_LATCH_PIN, HIGH);
+    digitalWrite(SHIFT595_LATCH_PIN, LOW);
+  }
+};
+typedef Shift595Output LedOutput;
+
+#elif LED_BACKEND == LED_BACKEND_DMX
+struct DmxOutput {
+  static void begin() {
+    dmxBegin();
+  }
+  static inline void set(int idx, bool on) {
+    dmxSetLed(idx, on);
+  }
+  static void setLevel(uint8_t level) {
+    uint8_t l = (uint16_t)DMX_LEVEL_ON * level / 255;
+    if (l == dmxLevel) return;
+    dmxLevel = l;
+    for (int i = 0; i < numLeds; i++) {
+      if (ledFrame[i >> 3] & (1 << (i & 7))) dmxSetLed(i, true);
+    }
+  }
+  static inline void service() {}
+};
+typedef DmxOutput LedOutput;
+
+#elif LED_BACKEND == LED_BACKEND_CHARLIE
+struct CharlieOutput {
+  static void begin() {
+    charlieBegin();
+  }
+  static inline void set(int idx, bool on) {
+    charlieSetLed(idx, on);
+  }
+  static void setLevel(uint8_t level) {
+    OCR4B = (unsigned long)CHARLIE_OCR_BLANK * level / 255 + 1;
+    if (level < 255 || CHARLIE_DUTY_PCT < 100) TIMSK4 |= _BV(OCIE4B);
+    else TIMSK4 &= ~_BV(OCIE4B);
+  }
+  static inline void service() {}
+};
+typedef CharlieOutput LedOutput;
+
+#elif LED_BACKEND == LED_BACKEND_MATRIX
+struct MatrixOutput {
+  static void begin() {
+    matrixBegin();
+  }
+  static inline void set(int idx, bool on) {
+    matrixSetLed(idx, on);
+  }
+  static void setLevel(uint8_t level) {
+    OCR4B = (unsigned long)MATRIX_OCR_ROW * level / 255 + 1;
+    if (level < 255) TIMSK4 |= _BV(OCIE4B);
+    else TIMSK4 &= ~_BV(OCIE4B);
+  }
+  static inline void service() {}
+};
+typedef MatrixOutput LedOutput;
+
+#else
+// Simulation: the framebuffer is the output
+struct SimOutput {
+  static void begin() {}
+  static inline void set(int, bool) {}
+  static void setLevel(uint8_t) {}
+  static inline void service() {}
+};
+typedef SimOutput LedOutput;
+#endif
+
+// Bar brightness for the hold warning and day phases
+inline void setBarLevel(uint8_t level) {
+  LedOutput::setLevel(level);
+}
+
 // ------------- Helpers -------------
+// Drive one LED on the selected backend (idx already range-checked)
+inline void writeLed(int idx, bool on) {
+#if LATENCY_MEASURE
+  if (on) latencyLedOn();
+#endif
+  if (on) ledFrame[idx >> 3] |= (1 << (idx & 7));
+  else    ledFrame[idx >> 3] &= ~(1 << (idx & 7));
+  LedOutput::set(idx, on);
+}
+
+// 16 LEDs of the framebuffer starting at LED 16 * w (0 past the end)
+uint16_t ledFrameWord(int w) {
+  int b = 2 * w;
+  uint16_t lo = (b < (int)sizeof(ledFrame)) ? ledFrame[b] : 0;
+  uint16_t hi = (b + 1 < (int)sizeof(ledFrame)) ? ledFrame[b + 1] : 0;
+  return lo | (hi << 8);
+}
+
 void allLedsOff() {
-  for (int i = 0; i < numLeds; i++) digitalWrite(ledPins[i], LOW);
+  for (int i = 0; i < numLeds; i++) writeLed(i, false);
 }
 
 void allLedsOn() {
-  for (int i = 0; i < numLeds; i++) digitalWrite(ledPins[i], HIGH);
+  for (int i = 0; i < numLeds; i++) writeLed(i, true);
 }
 
 void resetToIdle() {
   allLedsOff();
   state = IDLE;
   currentLed = 0;
-  lastStepTime = 0;
-  holdStartTime = 0;
+  lastStepTime = MsTime();
+  holdStartTime = MsTime();
   s1Released = false;
+#if HOLD_WARNING
+  s1HoldExtend = false;
+#endif
 }
 
-// Debounce one sensor; returns its stable state (LOW/HIGH)
-int debounceRead(int pin, int &lastRead, unsigned long &lastChange, int &stable) {
-  unsigned long now = millis();
-  int reading = digitalRead(pin);
+// Rebuild the active holds from their sources (see holdS1BaseMs)
+void holdRecompute() {
+  Ms s1 = holdS1BaseMs, s2s3 = holdS2S3BaseMs;
+#if AUTO_HOLD_TUNING
+  if (holdLearnedMs != Ms()) s1 = s2s3 = holdLearnedMs;
+#endif
+  holdS1Ms   = Ms((s1.count * holdScale16) >> 4);
+  holdS2S3Ms = Ms((s2s3.count * holdScale16) >> 4);
+}
+
+// Debounce one sensor reading; returns its stable state (LOW/HIGH)
+int debounceRead(int reading, unsigned long now, int &lastRead, unsigned long &lastChange, int &stable) {
   if (reading != lastRead) {
     lastChange = now;
     lastRead = reading;
   }
-  if (now - lastChange > DEBOUNCE_MS) {
+#if FAST_START
+  unsigned long settle = (reading == HIGH) ? DEBOUNCE_RISE_MS : debounceMs;
+#else
+  unsigned long settle = debounceMs;
+#endif
+  if (now - lastChange > settle) {
     stable = reading; // stable long enough
   }
   return stable;
 }
 
-// Safe digitalWrite for an LED index
-inline void setLed(int idx, bool on) {
-  if (idx >= 0 && idx < numLeds) digitalWrite(ledPins[idx], on ? HIGH : LOW);
+#if !ISR_SAMPLER
+// Lazy debounce: the pins are read straight from their input ports into one packed
+// vector. While it matches the previous readings and no channel is still settling
+// (every stable level equals its reading), debounceRead() could change nothing, so an
+// idle pass ends at one compare.
+uint8_t debRawVec = 0;             // bit n = last raw reading of sensor n+1
+bool debSettling = false;          // some reading differs from its stable level
+
+void debounceAll(unsigned long now) {
+  uint8_t raw = sensorRawVec();
+  if (raw == debRawVec && !debSettling) return;
+  debRawVec = raw;
+  debounceRead((raw & 0x01) ? HIGH : LOW, now, s1LastRead, s1LastChange, s1Stable);
+  debounceRead((raw & 0x02) ? HIGH : LOW, now, s2LastRead, s2LastChange, s2Stable);
+  debounceRead((raw & 0x04) ? HIGH : LOW, now, s3LastRead, s3LastChange, s3Stable);
+  debSettling = s1Stable != s1LastRead || s2Stable != s2LastRead || s3Stable != s3LastRead;
 }
+#endif
 
-// ------------- Arduino setup/loop -------------
-void setup() {
-  for (int i = 0; i < numLeds; i++) {
-    pinMode(ledPins[i], OUTPUT);
-    digitalWrite(ledPins[i], LOW);
+#if ISR_SAMPLER
+// ------------- 1 kHz sensor sampler (Timer2) -------------
+// Every 1 ms the ISR shifts each raw pin into an 8-bit history and takes the majority of
+// the last 5 samples, which rejects spikes of up to 2 ms. The voted bit drives an
+// integrator (+1 per HIGH ms, -1 per LOW ms, clamped to samplerFall): the output goes
+// HIGH once it reaches samplerRise and LOW only when it drains to 0. Noise rejection is
+// therefore set by the sample clock, not by how busy loop() is. loop() only reads
+// sampledVec, a single byte, so no locking is needed.
+const uint8_t VOTE_POPCOUNT[32] = {
+  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+  1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5
+};
+
+volatile uint8_t sampledVec = 0;   // bit n = filtered sensor n+1
+uint8_t samplerHist[3];
+uint8_t samplerLevel[3];
+uint8_t samplerRise, samplerFall;  // integrator thresholds in ms
+
+void samplerSetTiming() {
+#if FAST_START
+  unsigned long rise = DEBOUNCE_RISE_MS;
+#else
+  unsigned long rise = debounceMs;
+#endif
+  samplerFall = debounceMs > 255 ? 255 : (debounceMs < 1 ? 1 : debounceMs);
+  samplerRise = rise > samplerFall ? samplerFall : (rise < 1 ? 1 : rise);
+}
+
+void samplerBegin() {
+  samplerSetTiming();
+  TCCR2A = _BV(WGM21);                           // CTC
+  TCCR2B = _BV(CS22);                            // clk/64 -> 250 kHz
+  OCR2A  = 249;                                  // 1 kHz
+  TIMSK2 = _BV(OCIE2A);
+}
+
+ISR(TIMER2_COMPA_vect) {
+  ISR_ENTER();
+  uint8_t vec = sampledVec;
+  uint8_t raw = sensorRawVec();
+  for (uint8_t i = 0; i < 3; i++) {
+    uint8_t h = (samplerHist[i] << 1) | ((raw >> i) & 1);
+    samplerHist[i] = h;
+    uint8_t lvl = samplerLevel[i];
+    if (VOTE_POPCOUNT[h & 0x1F] >= 3) {
+      if (lvl < samplerFall) lvl++;
+    } else if (lvl > 0) {
+      lvl--;
+    }
+    samplerLevel[i] = lvl;
+    if (lvl >= samplerRise) vec |= (1 << i);
+    else if (lvl == 0) vec &= ~(1 << i);
   }
+  sampledVec = vec;
+}
+#endif
 
-  // Using INPUT based on your wiring (you said hardware provides proper levels)
-  pinMode(sensor1Pin, INPUT);
-  pinMode(sensor2Pin, INPUT);
-  pinMode(sensor3Pin, INPUT);
+#if AUTO_HOLD_TUNING
+// ------------- Hold auto-tuning -------------
+// Inter-trigger gaps go into a log2 histogram (bucket b holds gaps in [2^b, 2^(b+1)) ms).
+// The hold is set to the upper edge of the bucket that reaches HOLD_PERCENTILE, so the
+// next trigger usually lands before the bar goes dark. Counts are halved when a bucket
+// or the total would overflow, which ages out old traffic patterns.
+const int GAP_BUCKETS = 18;                      // 2^18 ms ~ 4.4 min, longer gaps clamp here
+uint16_t gapHist[GAP_BUCKETS];
+uint16_t gapSamples = 0;
+unsigned long lastTriggerTime = 0;
+bool haveLastTrigger = false;
+
+int gapBucket(unsigned long gap) {
+  int b = 0;
+  while (gap > 1 && b < GAP_BUCKETS - 1) { gap >>= 1; b++; }
+  return b;
 }
 
-void loop() {
-  unsigned long now = millis();
+void recordTriggerGap(unsigned long now) {
+  if (haveLastTrigger) {
+    int b = gapBucket(now - lastTriggerTime);
+    if (gapHist[b] == 0xFFFF || gapSamples == 0xFFFF) {
+      gapSamples = 0;
+      for (int i = 0; i < GAP_BUCKETS; i++) {
+        gapHist[i] >>= 1;
+        gapSamples += gapHist[i];
+      }
+    }
+    gapHist[b]++;
+    gapSamples++;
 
-  // Debounce all sensors
-  debounceRead(sensor1Pin, s1LastRead, s1LastChange, s1Stable);
-  debounceRead(sensor2Pin, s2LastRead, s2LastChange, s2Stable);
-  debounceRead(sensor3Pin, s3LastRead, s3LastChange, s3Stable);
+    if (gapSamples >= HOLD_MIN_SAMPLES) {
+      // Walk up to the bucket holding the target percentile
+      unsigned long target = ((unsigned long)gapSamples * HOLD_PERCENTILE + 99) / 100;
+      unsigned long seen = 0;
+      int i = 0;
+      for (; i < GAP_BUCKETS - 1; i++) {
+        seen += gapHist[i];
+        if (seen >= target) break;
+      }
+      unsigned long hold = 2UL << i; // upper edge of bucket i
+      if (hold < HOLD_MIN_MS) hold = HOLD_MIN_MS;
+      if (hold > HOLD_MAX_MS) hold = HOLD_MAX_MS;
+      holdLearnedMs = Ms(hold);
+      holdRecompute();
+    }
+  }
+  lastTriggerTime = now;
+  haveLastTrigger = true;
+}
 
-  // ========================= SENSOR 1 (MASTER) =========================
-  // Start or maintain S1 while pin is HIGH
-  if (s1Stable == HIGH) {
-    if (!(state == S1_SWEEP_ON || state == S1_PEAK_DWELL || state == S1_OFF_INSTANT)) {
-      // Take control if not already in the S1 running states or post-release phases
-      s1Released = false;
-      allLedsOff();
-      state = S1_SWEEP_ON;
-      currentLed = 0;
-      lastStepTime = now;
+#endif
+
+// CRC-16/MODBUS (poly 0xA001 reflected, init 0xFFFF), shared by Modbus and config frames
+uint16_t crc16(const uint8_t *buf, uint8_t len) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
     }
-  } else {
-    // s1 is LOW: if we are in running S1 states, mark release so we finish sequence
-    if (state == S1_SWEEP_ON || state == S1_PEAK_DWELL || state == S1_OFF_INSTANT) {
-      s1Released = true;
+  }
+  return crc;
+}
+
+// Latch the debounced sensor vector, find rising edges, count triggers
+void updateSensorEdges() {
+  uint8_t vec = (s1Stable == HIGH ? 0x01 : 0) |
+                (s2Stable == HIGH ? 0x02 : 0) |
+                (s3Stable == HIGH ? 0x04 : 0);
+  sensorRose = vec & ~sensorVec;
+  sensorVec = vec;
+  if (sensorRose) {
+    for (int i = 0; i < 3; i++) {
+      if (sensorRose & (1 << i)) triggerCount[i]++;
     }
   }
+}
+
+// Interval before step `stepNo` (0 = first LED of the sweep) of an S1 / S2-S3 sweep
+inline Ms stepMsMaster(int stepNo) {
+#if SWEEP_PROFILE == PROFILE_LINEAR
+  (void)stepNo;
+  unsigned long ms = stepMsMasterCfg;
+#else
+  unsigned long ms = pgm_read_word(&EASE_MASTER.ms[stepNo]);
+#endif
+#if RTC_SCHEDULE
+  ms = (ms * stepScale16) >> 4;
+#endif
+  return Ms(ms);
+}
 
-  // --- S1: ON sweep 1->17 ---
-  if (state == S1_SWEEP_ON) {
-    if (now - lastStepTime >= STEP_MS_MASTER) {
-      lastStepTime = now;
-      setLed(currentLed, true);
-      currentLed++;
-      if (currentLed >= numLeds) {
-        // Finished ON sweep
-        if (!s1Released && s1Stable == HIGH) {
-          // Dwell briefly with all ON so LED 17 is visibly on
-          state = S1_PEAK_DWELL;
-          lastStepTime = now; // reset for dwell
-        } else {
-          // Released during ON sweep: we are now ALL ON -> hold for 30s
-          holdStartTime = now;
-          state = S1_HOLD_ON;
+inline Ms stepMsS2S3(int stepNo) {
+#if SWEEP_PROFILE == PROFILE_LINEAR
+  (void)stepNo;
+  unsigned long ms = stepMsS2S3Cfg;
+#else
+  unsigned long ms = pgm_read_word(&EASE_S2S3.ms[stepNo]);
+#endif
+#if RTC_SCHEDULE
+  ms = (ms * stepScale16) >> 4;
+#endif
+  return Ms(ms);
+}
+
+// lastStepTime for a freshly triggered sweep: the first step is due one step period
+// from now, or only FIRST_STEP_LEAD_MS from now with FAST_START
+inline MsTime firstStepBase(MsTime now, Ms stepMs) {
+#if FAST_START
+  return now - stepMs + (Ms(FIRST_STEP_LEAD_MS) < stepMs ? Ms(FIRST_STEP_LEAD_MS) : stepMs);
+#else
+  (void)stepMs;
+  return now;
+#endif
+}
+
+#if GESTURES
+// ------------- Gestures -------------
+// One 3-byte automaton per sensor, fed the debounced level every loop. It only watches
+// the edge stream; normal triggers still act on the first rising edge, so gestures add
+// no latency. Timestamps are 16-bit (wrap-safe for gaps under ~65 s).
+enum GesturePhase : uint8_t { G_IDLE, G_DOWN, G_UP, G_WAIT_UP };
+enum GestureEvent : uint8_t { GEST_NONE = 0, GEST_DOUBLE_TAP = 1, GEST_LONG_HOLD = 2 };
+
+struct Gesture {
+  uint8_t  phase;
+  uint16_t since;          // millis() & 0xFFFF at the last transition
+};
+
+Gesture gestures[3];
+bool    holdLatched  = false;     // double-tap latch: holds never expire
+uint8_t trigSuppress = 0;         // sensors ignored until they read LOW again
+
+uint8_t gestureStep(Gesture &g, bool high, uint16_t now16) {
+  uint16_t dt = now16 - g.since;
+  switch (g.phase) {
+    case G_IDLE:
+      if (high) { g.phase = G_DOWN; g.since = now16; }
+      break;
+    case G_DOWN:
+      if (!high) {
+        g.phase = (dt <= TAP_MAX_MS) ? G_UP : G_IDLE;
+        g.since = now16;
+      } else if (dt >= LONG_HOLD_MS) {
+        g.phase = G_WAIT_UP;
+        return GEST_LONG_HOLD;
+      }
+      break;
+    case G_UP:
+      if (high) {
+        g.since = now16;
+        if (dt <= DOUBLE_TAP_GAP_MS) {
+          g.phase = G_WAIT_UP;
+          return GEST_DOUBLE_TAP;
         }
+        g.phase = G_DOWN;
+      } else if (dt > DOUBLE_TAP_GAP_MS) {
+        g.phase = G_IDLE;
       }
+      break;
+    default:                     // G_WAIT_UP: gesture consumed, wait for release
+      if (!high) { g.phase = G_IDLE; g.since = now16; }
+      break;
+  }
+  return GEST_NONE;
+}
+
+void updateGestures(unsigned long now) {
+  uint16_t now16 = (uint16_t)now;
+  for (uint8_t i = 0; i < 3; i++) {
+    uint8_t ev = gestureStep(gestures[i], sensorVec & (1 << i), now16);
+    if (ev == GEST_DOUBLE_TAP && i == GESTURE_LATCH_SENSOR) {
+      holdLatched = !holdLatched;
+    } else if (ev == GEST_LONG_HOLD && i == GESTURE_OFF_SENSOR) {
+      holdLatched = false;
+      resetToIdle();
+      trigSuppress |= 1 << i;    // the held sensor must not restart a sequence
     }
-    return; // while S1 running, ignore S2/S3
   }
+  trigSuppress &= sensorVec;
+}
+#endif
 
-  // --- S1: peak dwell at "all ON" before OFF ---
-  if (state == S1_PEAK_DWELL) {
-    if (now - lastStepTime >= S1_TOP_DWELL_MS) {
-      if (!s1Released && s1Stable == HIGH) {
-        // After brief dwell, do the OFF phase and repeat
-        state = S1_OFF_INSTANT;
-      } else {
-        // If released by now, go to the 30s hold with all LEDs ON
-        holdStartTime = now;
-        state = S1_HOLD_ON;
-      }
+// ------------- Sensor fusion -------------
+// The three rules are folded into one 8-entry table: fusionLUT[sensorVec] gives the
+// logical trigger vector in a single lookup, however complex the rules are.
+#define FUSE_ENTRY(v) (uint8_t)(((FUSE_S1 >> (v)) & 1) | (((FUSE_S2 >> (v)) & 1) << 1) | (((FUSE_S3 >> (v)) & 1) << 2))
+uint8_t fusionLUT[8] = {
+  FUSE_ENTRY(0), FUSE_ENTRY(1), FUSE_ENTRY(2), FUSE_ENTRY(3),
+  FUSE_ENTRY(4), FUSE_ENTRY(5), FUSE_ENTRY(6), FUSE_ENTRY(7)
+};
+
+// Replace the rules at runtime (e.g. from config)
+void setFusionRules(uint8_t rule1, uint8_t rule2, uint8_t rule3) {
+  for (uint8_t v = 0; v < 8; v++) {
+    fusionLUT[v] = ((rule1 >> v) & 1) | (((rule2 >> v) & 1) << 1) | (((rule3 >> v) & 1) << 2);
+  }
+}
+
+// Safe digitalWrite for an LED index
+inline void setLed(int idx, bool on) {
+  if (idx >= 0 && idx < numLeds) writeLed(idx, on);
+}
+
+#if HOLD_WARNING
+// ------------- Hold-expiry warning -------------
+uint8_t warnLevel = 255;
+
+// Time left in the current hold, or HOLD_WARN_MS + 1 when not holding
+unsigned long holdRemaining(MsTime now) {
+  Ms hold;
+  if (state == S1_HOLD_ON) hold = holdS1Ms;
+  else if (state == S2_HOLD_ON || state == S3_HOLD_ON) hold = holdS2S3Ms;
+  else return HOLD_WARN_MS + 1;
+  Ms held = now - holdStartTime;
+  return held < hold ? (hold - held).count : 0;
+}
+
+inline bool holdInWarning(MsTime now) {
+  return holdRemaining(now) <= HOLD_WARN_MS;
+}
+
+void holdWarningService(unsigned long now) {
+  unsigned long left = holdRemaining(MsTime(now));
+  uint8_t level = 255;
+  if (left <= HOLD_WARN_MS) {
+    const uint8_t span = 255 - HOLD_WARN_MIN_LEVEL;
+#if HOLD_WARN_STYLE == WARN_BREATHE
+    unsigned long t = (HOLD_WARN_MS - left) % HOLD_WARN_BREATHE_MS;
+    unsigned long half = HOLD_WARN_BREATHE_MS / 2;
+    unsigned long tri = (t < half) ? half - t : t - half;   // half..0..half
+    level = HOLD_WARN_MIN_LEVEL + span * tri / half;
+#else
+    level = HOLD_WARN_MIN_LEVEL + span * left / HOLD_WARN_MS;
+#endif
+  }
+#if RTC_SCHEDULE
+  level = (uint16_t)level * dayLevel / 255;
+#endif
+  if (level != warnLevel) {
+    warnLevel = level;
+    setBarLevel(level);
+  }
+}
+#endif
+
+#if RTC_SCHEDULE
+// ------------- RTC schedule -------------
+// The RTC is read with a polled TWI state machine: each loop() advances at most one bus
+// step (a few register accesses), so a read never blocks. Once a minute the minutes and
+// hours registers are fetched and applyDayMinute() caches the day phase; the FSM only
+// ever sees the cached hold/step/level values. Host builds can skip the bus and feed
+// applyDayMinute() from a simulated clock.
+enum RtcStep : uint8_t {
+  RTC_IDLE, RTC_START, RTC_SLA_W, RTC_REG, RTC_RESTART, RTC_SLA_R, RTC_MIN, RTC_HOUR
+};
+
+RtcStep rtcStep = RTC_IDLE;
+unsigned long lastRtcPoll = 0;
+bool rtcEverPolled = false;
+uint8_t rtcMinutes = 0;
+uint8_t dayPhase = 0xFF;           // none yet
+
+inline uint8_t bcdToBin(uint8_t v) {
+  return (v >> 4) * 10 + (v & 0x0F);
+}
+
+void applyDayMinute(uint16_t minuteOfDay) {
+  uint8_t phase = SCHEDULE[0].phase;
+  for (uint8_t i = 0; i < sizeof(SCHEDULE) / sizeof(SCHEDULE[0]); i++) {
+    if (minuteOfDay >= SCHEDULE[i].startMinute) phase = SCHEDULE[i].phase;
+  }
+  if (phase == dayPhase) return;
+  dayPhase = phase;
+  const DayPhase &p = DAY_PHASES[phase];
+  holdScale16 = p.holdScale16;
+  holdRecompute();
+  stepScale16 = p.stepScale16;
+  dayLevel = p.level;
+#if !HOLD_WARNING
+  setBarLevel(dayLevel);
+#endif
+}
+
+void rtcBegin() {
+  TWSR = 0;
+  TWBR = (F_CPU / 100000UL - 16) / 2;              // 100 kHz
+  TWCR = _BV(TWEN);
+}
+
+inline void rtcAbort() {
+  TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+  rtcStep = RTC_IDLE;                              // retry at the next poll
+}
+
+void rtcPoll(unsigned long now) {
+  if (rtcStep == RTC_IDLE) {
+    if (rtcEverPolled && now - lastRtcPoll < RTC_POLL_MS) return;
+    rtcEverPolled = true;
+    lastRtcPoll = now;
+    TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+    rtcStep = RTC_START;
+    return;
+  }
+  if (!(TWCR & _BV(TWINT))) {                      // bus step still in progress
+    if (now - lastRtcPoll >= RTC_TIMEOUT_MS) {     // stuck bus or RTC gone: reset the TWI
+      TWCR = 0;
+      TWCR = _BV(TWEN);
+      rtcStep = RTC_IDLE;                          // retry at the next poll
     }
     return;
   }
+  uint8_t status = TWSR & 0xF8;
+  switch (rtcStep) {
+    case RTC_START:
+      if (status != 0x08) { rtcAbort(); return; }
+      TWDR = RTC_I2C_ADDR << 1;
+      TWCR = _BV(TWINT) | _BV(TWEN);
+      rtcStep = RTC_SLA_W;
+      break;
+    case RTC_SLA_W:
+      if (status != 0x18) { rtcAbort(); return; }
+      TWDR = 0x01;                                 // minutes register
+      TWCR = _BV(TWINT) | _BV(TWEN);
+      rtcStep = RTC_REG;
+      break;
+    case RTC_REG:
+      if (status != 0x28) { rtcAbort(); return; }
+      TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+      rtcStep = RTC_RESTART;
+      break;
+    case RTC_RESTART:
+      if (status != 0x10) { rtcAbort(); return; }
+      TWDR = (RTC_I2C_ADDR << 1) | 1;
+      TWCR = _BV(TWINT) | _BV(TWEN);
+      rtcStep = RTC_SLA_R;
+      break;
+    case RTC_SLA_R:
+      if (status != 0x40) { rtcAbort(); return; }
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWEA);   // read minutes, ACK
+      rtcStep = RTC_MIN;
+      break;
+    case RTC_MIN:
+      if (status != 0x50) { rtcAbort(); return; }
+      rtcMinutes = bcdToBin(TWDR & 0x7F);
+      TWCR = _BV(TWINT) | _BV(TWEN);               // read hours, NACK
+      rtcStep = RTC_HOUR;
+      break;
+    case RTC_HOUR: {
+      if (status != 0x58) { rtcAbort(); return; }
+      uint8_t h = TWDR;
+      uint8_t hours = (h & 0x40)                   // 12-hour mode
+        ? bcdToBin(h & 0x1F) % 12 + ((h & 0x20) ? 12 : 0)
+        : bcdToBin(h & 0x3F);
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+      rtcStep = RTC_IDLE;
+      applyDayMinute(hours * 60 + rtcMinutes);
+      break;
+    }
+    default:
+      rtcAbort();
+      break;
+  }
+}
+#endif
 
-  // --- S1: turn all OFF instantly (single shot) ---
-  if (state == S1_OFF_INSTANT) {
-    allLedsOff();
-    if (!s1Released && s1Stable == HIGH) {
-      // Continue the run: start another ON sweep
-      currentLed = 0;
-      lastStepTime = now;
-      state = S1_SWEEP_ON;
+#if TELEMETRY
+// Periodic STATUS frame: fixed layout so a collector can read fields in place
+struct StatusFrame {
+  uint8_t  controllerId;
+  uint8_t  state;
+  uint8_t  sensors;        // debounced S1..S3 in bits 0..2
+  uint8_t  flags;          // bit0 = s1Released
+  uint16_t triggerCount[3];
+  uint16_t ledWord[2];     // LEDs 0..15, 16..31
+  uint32_t uptimeMs;
+};
+
+unsigned long lastStatusReport = 0;
+
+void statusReport(unsigned long now) {
+  if (now - lastStatusReport < STATUS_REPORT_MS) return;
+  lastStatusReport = now;
+  StatusFrame f;
+  f.controllerId = CONTROLLER_ID;
+  f.state        = (uint8_t)state;
+  f.sensors      = sensorVec;
+  f.flags        = s1Released ? 0x01 : 0;
+  memcpy(f.triggerCount, triggerCount, sizeof(triggerCount));
+  f.ledWord[0]   = ledFrameWord(0);
+  f.ledWord[1]   = ledFrameWord(1);
+  f.uptimeMs     = now;
+  telemetrySend(TLM_STATUS, &f, sizeof(f));
+}
+#endif
+
+#if TELEMETRY && TRACE
+// ------------- Change trace -------------
+// A record is written only when (state, currentLed, sensors) changes. The framebuffer is
+// implied by state + currentLed (see checkInvariants) except under a Modbus force, so
+// the force mode rides in bits 6..7 of the sensors field instead. Record:
+// dt (ms since previous record, LEB128 varint), state, currentLed + 1, sensors | force << 6.
+// Records are batched into TRACE frames; a host tool can split the fields into columns.
+const uint8_t TRACE_BUF_SIZE = 48;
+
+uint8_t traceBuf[TRACE_BUF_SIZE];
+uint8_t traceLen = 0;
+unsigned long traceLastTime = 0, traceFirstTime = 0;
+uint8_t traceLastState = 0xFF, traceLastLed = 0xFF, traceLastSensors = 0xFF;
+
+void traceFlush() {
+  if (traceLen == 0) return;
+  if (telemetrySend(TLM_TRACE, traceBuf, traceLen)) traceLen = 0;
+}
+
+void traceUpdate(unsigned long now) {
+  uint8_t led = (uint8_t)(currentLed + 1);
+  uint8_t sensors = sensorVec;
+#if MODBUS_SLAVE
+  sensors |= (uint8_t)forceMode << 6;
+#endif
+  if ((uint8_t)state != traceLastState || led != traceLastLed || sensors != traceLastSensors) {
+    if (traceLen + 8 > TRACE_BUF_SIZE) {            // 5-byte varint + 3 fields
+      traceFlush();
+      if (traceLen != 0) return;                     // TX busy: drop, record again next pass
+    }
+    if (traceLen == 0) traceFirstTime = now;
+    unsigned long dt = now - traceLastTime;
+    do {
+      uint8_t b = dt & 0x7F;
+      dt >>= 7;
+      traceBuf[traceLen++] = dt ? (b | 0x80) : b;
+    } while (dt);
+    traceBuf[traceLen++] = (uint8_t)state;
+    traceBuf[traceLen++] = led;
+    traceBuf[traceLen++] = sensors;
+    traceLastTime = now;
+    traceLastState = (uint8_t)state;
+    traceLastLed = led;
+    traceLastSensors = sensors;
+  }
+  if (traceLen > 0 && now - traceFirstTime >= TRACE_FLUSH_MS) traceFlush();
+}
+#endif
+
+#if CONFIG_RELOAD
+// ------------- Config hot reload -------------
+// Frame on Serial: 0x5A, len, ConfigPayload (len bytes, little-endian), CRC-16 lo, hi
+// over len + payload. Bytes are parsed into a staging copy, at most SERIAL_RX_PER_LOOP
+// per pass. A frame that passes CRC, version and range checks is swapped in at the top
+// of the next loop(), i.e. between steps: a running sweep or hold carries on under the
+// new timing instead of restarting. Eased SWEEP_PROFILE tables are compile-time and
+// ignore the step fields.
+struct __attribute__((packed)) ConfigPayload {   // wire layout: no padding on any target
+  uint8_t  version;        // CONFIG_VERSION
+  uint16_t stepMsMaster;
+  uint16_t stepMsS2S3;
+  uint16_t s1TopDwellMs;
+  uint16_t debounceMs;
+  uint16_t holdS1Sec;
+  uint16_t holdS2S3Sec;
+  uint8_t  fuse[3];        // FUSE_S1..FUSE_S3 truth tables
+};
+static_assert(sizeof(ConfigPayload) == 16, "ConfigPayload must match the 16-byte frame payload");
+
+enum ConfigStatus : uint8_t { CFG_OK = 0, CFG_BAD_CRC = 1, CFG_BAD_VERSION = 2, CFG_BAD_VALUE = 3 };
+
+const uint8_t CFG_SYNC = 0x5A;
+
+uint8_t cfgRx[1 + sizeof(ConfigPayload) + 2];      // len, payload, crc
+uint8_t cfgRxPos = 0;                              // 0 = hunting for sync
+ConfigPayload cfgStaged;
+bool cfgPending = false;
+
+void configAck(uint8_t status) {
+#if TELEMETRY
+  telemetrySend(TLM_CONFIG_ACK, &status, 1);
+#else
+  (void)status;
+#endif
+}
+
+uint8_t configCheck(const ConfigPayload &c) {
+  if (c.version != CONFIG_VERSION) return CFG_BAD_VERSION;
+  if (c.stepMsMaster == 0 || c.stepMsMaster > CFG_STEP_MS_MAX) return CFG_BAD_VALUE;
+  if (c.stepMsS2S3 == 0 || c.stepMsS2S3 > CFG_STEP_MS_MAX) return CFG_BAD_VALUE;
+  if (c.s1TopDwellMs > CFG_DWELL_MS_MAX) return CFG_BAD_VALUE;
+  if (c.debounceMs == 0 || c.debounceMs > CFG_DEBOUNCE_MS_MAX) return CFG_BAD_VALUE;
+  if (c.holdS1Sec == 0 || c.holdS1Sec > CFG_HOLD_SEC_MAX) return CFG_BAD_VALUE;
+  if (c.holdS2S3Sec == 0 || c.holdS2S3Sec > CFG_HOLD_SEC_MAX) return CFG_BAD_VALUE;
+  return CFG_OK;
+}
+
+// Feed one Serial byte; returns false if it is not part of a config frame
+bool configRxByte(uint8_t c) {
+  if (cfgRxPos == 0) {
+    if (c != CFG_SYNC) return false;
+    cfgRxPos = 1;
+    return true;
+  }
+  if (cfgRxPos == 1 && c != sizeof(ConfigPayload)) {   // wrong length: resync
+    cfgRxPos = 0;
+    return true;
+  }
+  cfgRx[cfgRxPos - 1] = c;
+  if (++cfgRxPos <= sizeof(cfgRx)) return true;
+
+  cfgRxPos = 0;
+  uint16_t crc = crc16(cfgRx, 1 + sizeof(ConfigPayload));
+  const uint8_t *tail = cfgRx + 1 + sizeof(ConfigPayload);
+  if (tail[0] != (crc & 0xFF) || tail[1] != (crc >> 8)) {
+    configAck(CFG_BAD_CRC);
+    return true;
+  }
+  ConfigPayload staged;
+  memcpy(&staged, cfgRx + 1, sizeof(staged));
+  uint8_t status = configCheck(staged);
+  if (status == CFG_OK) {
+    cfgStaged = staged;
+    cfgPending = true;
+  }
+  configAck(status);
+  return true;
+}
+
+// Safe point: called at the top of loop(), never mid-step
+void configApply() {
+  if (!cfgPending) return;
+  cfgPending = false;
+  stepMsMasterCfg = cfgStaged.stepMsMaster;
+  stepMsS2S3Cfg   = cfgStaged.stepMsS2S3;
+  s1TopDwellMs    = Ms(cfgStaged.s1TopDwellMs);
+  debounceMs      = cfgStaged.debounceMs;
+  holdS1BaseMs    = seconds(cfgStaged.holdS1Sec);
+  holdS2S3BaseMs  = seconds(cfgStaged.holdS2S3Sec);
+  holdRecompute();
+  setFusionRules(cfgStaged.fuse[0], cfgStaged.fuse[1], cfgStaged.fuse[2]);
+#if ISR_SAMPLER
+  samplerSetTiming();
+#endif
+}
+#endif
+
+#if HISTORY
+// ------------- Activity history -------------
+// The open minute accumulates triggers, ON time and the longest loop() period. Each
+// closed minute goes into a 60-entry ring and into a running hour total; each closed
+// hour goes into a 24-entry ring. Counters are narrow and saturate. ~520 bytes total.
+// A dump is the raw History image sent as HISTORY frames ([offset lo, hi] + up to
+// HISTORY_CHUNK bytes), at most one frame per loop() so it never stalls the FSM.
+struct MinuteSummary {
+  uint8_t trig[3];         // triggers per sensor (saturating)
+  uint8_t onSec;           // seconds with any LED ON
+  uint8_t maxLoop64us;     // longest loop() period, 64us units (saturating)
+};
+
+struct HourSummary {
+  uint16_t trig[3];
+  uint16_t onSec;
+  uint8_t  maxLoop64us;
+};
+
+struct History {
+  uint8_t       minuteHead;        // next slot to write
+  uint8_t       hourHead;
+  uint8_t       minutesInHour;
+  MinuteSummary minutes[60];
+  HourSummary   hours[24];
+};
+
+const uint8_t HISTORY_CHUNK = 48;
+
+History history;
+MinuteSummary curMinute;
+HourSummary   curHour;
+unsigned long minuteStart = 0, lastHistSample = 0, onMsAcc = 0;
+unsigned long lastLoopUs = 0;
+int histDumpPos = -1;              // -1 = no dump in progress
+
+inline uint8_t sat8(unsigned long v) {
+  return v > 255 ? 255 : (uint8_t)v;
+}
+
+inline uint16_t sat16(unsigned long v) {
+  return v > 65535UL ? 65535 : (uint16_t)v;
+}
+
+void historyCloseMinute() {
+  curMinute.onSec = sat8(onMsAcc / 1000UL);
+  onMsAcc = 0;
+  history.minutes[history.minuteHead] = curMinute;
+  history.minuteHead = (history.minuteHead + 1) % 60;
+  for (int i = 0; i < 3; i++) curHour.trig[i] = sat16((unsigned long)curHour.trig[i] + curMinute.trig[i]);
+  curHour.onSec = sat16((unsigned long)curHour.onSec + curMinute.onSec);
+  if (curMinute.maxLoop64us > curHour.maxLoop64us) curHour.maxLoop64us = curMinute.maxLoop64us;
+  memset(&curMinute, 0, sizeof(curMinute));
+
+  if (++history.minutesInHour >= 60) {
+    history.minutesInHour = 0;
+    history.hours[history.hourHead] = curHour;
+    history.hourHead = (history.hourHead + 1) % 24;
+    memset(&curHour, 0, sizeof(curHour));
+  }
+}
+
+void historyUpdate(unsigned long now) {
+  unsigned long us = micros();
+  uint8_t loop64 = sat8((us - lastLoopUs) >> 6);
+  lastLoopUs = us;
+  if (loop64 > curMinute.maxLoop64us) curMinute.maxLoop64us = loop64;
+
+  for (int i = 0; i < 3; i++) {
+    if ((sensorRose & (1 << i)) && curMinute.trig[i] < 255) curMinute.trig[i]++;
+  }
+
+  uint8_t any = 0;
+  for (unsigned int i = 0; i < sizeof(ledFrame); i++) any |= ledFrame[i];
+  if (any) onMsAcc += now - lastHistSample;
+  lastHistSample = now;
+
+  if (now - minuteStart >= 60000UL) {
+    minuteStart += 60000UL;
+    historyCloseMinute();
+  }
+}
+
+void historyStartDump() {
+  if (histDumpPos < 0) histDumpPos = 0;
+}
+
+void historyDumpStep() {
+  if (histDumpPos < 0) return;
+  uint8_t frame[2 + HISTORY_CHUNK];
+  int n = sizeof(History) - histDumpPos;
+  if (n > HISTORY_CHUNK) n = HISTORY_CHUNK;
+  frame[0] = histDumpPos & 0xFF;
+  frame[1] = histDumpPos >> 8;
+  memcpy(frame + 2, (const uint8_t *)&history + histDumpPos, n);
+  if (!telemetrySend(TLM_HISTORY, frame, 2 + n)) return;   // TX full: retry next pass
+  histDumpPos += n;
+  if (histDumpPos >= (int)sizeof(History)) histDumpPos = -1;
+}
+#endif
+
+#if CONFIG_RELOAD || HISTORY
+// ------------- Serial commands -------------
+void serialPoll() {
+  for (uint8_t n = 0; n < SERIAL_RX_PER_LOOP && Serial.available() > 0; n++) {
+    uint8_t c = Serial.read();
+#if CONFIG_RELOAD
+    if (configRxByte(c)) continue;
+#endif
+#if HISTORY
+    if (c == HISTORY_REQ) historyStartDump();
+#endif
+  }
+}
+#endif
+
+#if MODBUS_SLAVE
+// ------------- Modbus RTU slave (USART2 + Timer3) -------------
+// RX bytes are collected by the USART2 RX interrupt; Timer3 is restarted on every
+// byte and fires after 3.5 character times of silence to close the frame. loop()
+// then handles at most one frame per pass (fixed, small cost) and the reply is
+// sent from the UDRE interrupt. Bytes arriving while a frame is pending or a reply
+// is going out are dropped, so a polling storm can never back up into loop().
+//
+// Registers (FC03/FC04 read, FC06 write):
+//   0 state           1 currentLed        2 LED mask 0..15   3 LED mask 16..31
+//   4 sensors (bit0..2 = S1..S3, bit8 = s1Released)
+//   5..7 trigger counts S1..S3           8 S1 hold (s)      9 S2/S3 hold (s)
+//  10 force mode (RW): 0 = auto, 1 = force OFF, 2 = force ON (see ForceMode)
+const uint8_t MB_REG_FORCE = 10;
+const uint8_t MB_REG_COUNT = 11;
+const uint8_t MB_BUF_SIZE  = 32;
+
+// t3.5 inter-frame gap: 3.5 chars of 11 bits, fixed 1750us above 19200 baud
+const unsigned long MB_T35_US  = (MODBUS_BAUD > 19200) ? 1750UL : (38500000UL / MODBUS_BAUD);
+const uint16_t      MB_T35_OCR = MB_T35_US / 4 - 1;     // Timer3 at clk/64 = 4us ticks
+
+uint8_t mbRx[MB_BUF_SIZE];
+uint8_t mbTx[MB_BUF_SIZE];
+volatile uint8_t mbRxLen = 0;
+volatile bool    mbRxOverflow = false;
+volatile bool    mbFrameReady = false;
+volatile bool    mbTxBusy = false;
+volatile uint8_t mbTxLen = 0, mbTxPos = 0;
+
+uint16_t modbusReadReg(uint8_t reg) {
+  switch (reg) {
+    case 0:  return (uint16_t)state;
+    case 1:  return (uint16_t)currentLed;
+    case 2:  return ledFrameWord(0);
+    case 3:  return ledFrameWord(1);
+    case 4:  return sensorVec | (s1Released ? 0x100 : 0);
+    case 5:  return triggerCount[0];
+    case 6:  return triggerCount[1];
+    case 7:  return triggerCount[2];
+    case 8:  return (uint16_t)(holdS1Ms.count / 1000UL);
+    case 9:  return (uint16_t)(holdS2S3Ms.count / 1000UL);
+    case MB_REG_FORCE: return (uint16_t)forceMode;
+    default: return 0;
+  }
+}
+
+void applyForceMode(ForceMode mode) {
+  if (mode == forceMode) return;
+  forceMode = mode;
+  resetToIdle();
+  if (mode == FORCE_ON) allLedsOn();
+}
+
+uint8_t modbusException(uint8_t fc, uint8_t code, uint8_t *resp) {
+  resp[1] = fc | 0x80;
+  resp[2] = code;
+  return 3;
+}
+
+// Handle one complete RTU frame (CRC included); returns reply length with CRC, 0 = no reply.
+// Hardware-free so it can be driven from a host build.
+uint8_t modbusHandleFrame(const uint8_t *req, uint8_t len, uint8_t *resp) {
+  if (len < 4) return 0;
+  uint16_t crc = crc16(req, len - 2);
+  if (req[len - 2] != (crc & 0xFF) || req[len - 1] != (crc >> 8)) return 0;
+  uint8_t addr = req[0];
+  if (addr != MODBUS_ADDRESS && addr != 0) return 0;
+
+  uint8_t fc = req[1];
+  uint8_t n;
+  resp[0] = MODBUS_ADDRESS;
+  resp[1] = fc;
+
+  if ((fc == 3 || fc == 4) && len == 8) {
+    uint16_t start = (req[2] << 8) | req[3];
+    uint16_t count = (req[4] << 8) | req[5];
+    if (count == 0 || count > MB_REG_COUNT) {
+      n = modbusException(fc, 3, resp);
+    } else if (start + count > MB_REG_COUNT) {
+      n = modbusException(fc, 2, resp);
     } else {
-      // Released during/at this OFF phase:
-      // finish sequence -> ensure ALL ON, then hold 30s, then reverse OFF
-      currentLed = 0;
-      lastStepTime = now;
-      state = S1_FINISH_ON_TO_HOLD; // do one more ON sweep to get to ALL ON
+      resp[2] = count * 2;
+      n = 3;
+      for (uint16_t r = start; r < start + count; r++) {
+        uint16_t v = modbusReadReg(r);
+        resp[n++] = v >> 8;
+        resp[n++] = v & 0xFF;
+      }
     }
-    return;
+  } else if (fc == 6 && len == 8) {
+    uint16_t reg = (req[2] << 8) | req[3];
+    uint16_t val = (req[4] << 8) | req[5];
+    if (reg != MB_REG_FORCE) {
+      n = modbusException(fc, 2, resp);
+    } else if (val > FORCE_ON) {
+      n = modbusException(fc, 3, resp);
+    } else {
+      applyForceMode((ForceMode)val);
+      for (n = 2; n < 6; n++) resp[n] = req[n];   // echo request
+    }
+  } else {
+    n = modbusException(fc, 1, resp);
   }
 
-  // --- S1: finish to ALL ON (after release) ---
-  if (state == S1_FINISH_ON_TO_HOLD) {
-    if (now - lastStepTime >= STEP_MS_MASTER) {
-      lastStepTime = now;
-      setLed(currentLed, true);
-      currentLed++;
-      if (currentLed >= numLeds) {
+  if (addr == 0) return 0;                       // broadcast: act, never reply
+  crc = crc16(resp, n);
+  resp[n++] = crc & 0xFF;
+  resp[n++] = crc >> 8;
+  return n;
+}
+
+ISR(USART2_RX_vect) {
+  ISR_ENTER();
+  bool bad = UCSR2A & (_BV(FE2) | _BV(UPE2) | _BV(DOR2));
+  uint8_t c = UDR2;
+  if (!mbFrameReady && !mbTxBusy) {              // previous frame still pending: drop
+    if (bad || mbRxLen >= MB_BUF_SIZE) mbRxOverflow = true;
+    else mbRx[mbRxLen++] = c;
+    TCNT3 = 0;
+    TCCR3B = _BV(WGM32) | _BV(CS31) | _BV(CS30); // (re)start t3.5 timer
+  }
+}
+
+// 3.5 char times of silence: frame complete
+ISR(TIMER3_COMPA_vect) {
+  ISR_ENTER();
+  TCCR3B = _BV(WGM32);                           // stop timer
+  if (mbRxOverflow) {
+    mbRxLen = 0;
+    mbRxOverflow = false;
+  } else if (mbRxLen > 0) {
+    mbFrameReady = true;
+  }
+}
+
+ISR(USART2_UDRE_vect) {
+  ISR_ENTER();
+  UDR2 = mbTx[mbTxPos++];
+  if (mbTxPos >= mbTxLen) {
+    UCSR2B = (UCSR2B & ~_BV(UDRIE2)) | _BV(TXCIE2);
+  }
+}
+
+// Last stop bit is out: release the bus
+ISR(USART2_TX_vect) {
+  ISR_ENTER();
+  digitalWrite(MODBUS_DE_PIN, LOW);
+  UCSR2B &= ~_BV(TXCIE2);
+  mbTxBusy = false;
+}
+
+void modbusBegin() {
+  pinMode(MODBUS_DE_PIN, OUTPUT);
+  digitalWrite(MODBUS_DE_PIN, LOW);
+  UBRR2 = F_CPU / 16 / MODBUS_BAUD - 1;
+  UCSR2A = 0;
+  UCSR2C = _BV(UPM21) | _BV(UCSZ21) | _BV(UCSZ20);  // 8E1
+  UCSR2B = _BV(RXEN2) | _BV(TXEN2) | _BV(RXCIE2);
+  TCCR3A = 0;
+  TCCR3B = _BV(WGM32);
+  OCR3A  = MB_T35_OCR;
+  TIMSK3 = _BV(OCIE3A);
+}
+
+// Handle at most one pending request per loop()
+void modbusPoll() {
+  if (!mbFrameReady) return;
+  uint8_t n = modbusHandleFrame(mbRx, mbRxLen, mbTx);
+  if (n > 0) {
+    mbTxLen = n;
+    mbTxPos = 0;
+    mbTxBusy = true;
+    digitalWrite(MODBUS_DE_PIN, HIGH);
+    UCSR2B |= _BV(UDRIE2);
+  }
+  mbRxLen = 0;
+  mbFrameReady = false;
+}
+#endif
+
+// ------------- Snapshot / restore -------------
+// Complete controller state as a fixed-size POD, so a simulation can fork from a
+// shared prefix instead of replaying from setup(). Save is a plain copy; restore
+// also pushes the framebuffer out to the active backend.
+struct ControllerSnapshot {
+  uint8_t  state;
+  int16_t  currentLed;
+  uint32_t lastStepTime;
+  uint32_t holdStartTime;
+  uint32_t holdS2S3BaseMs;
+  uint32_t holdS1BaseMs;
+  uint8_t  s1Released;
+  uint8_t  stable[3];
+  uint8_t  lastRead[3];
+  uint32_t lastChange[3];
+  uint8_t  sensorVec;
+  uint16_t triggerCount[3];
+  uint8_t  frame[sizeof(ledFrame)];
+#if AUTO_HOLD_TUNING
+  uint16_t gapHist[GAP_BUCKETS];
+  uint16_t gapSamples;
+  uint32_t lastTriggerTime;
+  uint8_t  haveLastTrigger;
+  uint32_t holdLearnedMs;
+#endif
+#if ISR_SAMPLER
+  uint8_t  samplerHist[3];
+  uint8_t  samplerLevel[3];
+  uint8_t  sampledVec;
+#endif
+#if MODBUS_SLAVE
+  uint8_t  forceMode;
+#endif
+#if HOLD_WARNING
+  uint8_t  s1HoldExtend;
+#endif
+#if GESTURES
+  Gesture  gestures[3];
+  uint8_t  holdLatched;
+  uint8_t  trigSuppress;
+#endif
+#if CONFIG_RELOAD
+  uint32_t stepMsMasterCfg;
+  uint32_t stepMsS2S3Cfg;
+  uint16_t s1TopDwellMs;
+  uint32_t debounceMs;
+  uint8_t  fusionLUT[8];
+#endif
+#if RTC_SCHEDULE
+  uint8_t  stepScale16;
+  uint8_t  holdScale16;
+  uint8_t  dayLevel;
+  uint8_t  dayPhase;
+#endif
+};
+
+void saveSnapshot(ControllerSnapshot &snap) {
+  snap.state         = (uint8_t)state;
+  snap.currentLed    = currentLed;
+  snap.lastStepTime  = lastStepTime.ticks;
+  snap.holdStartTime = holdStartTime.ticks;
+  snap.holdS2S3BaseMs = holdS2S3BaseMs.count;
+  snap.holdS1BaseMs   = holdS1BaseMs.count;
+  snap.s1Released    = s1Released;
+  snap.stable[0]     = s1Stable;     snap.stable[1]     = s2Stable;     snap.stable[2]     = s3Stable;
+  snap.lastRead[0]   = s1LastRead;   snap.lastRead[1]   = s2LastRead;   snap.lastRead[2]   = s3LastRead;
+  snap.lastChange[0] = s1LastChange; snap.lastChange[1] = s2LastChange; snap.lastChange[2] = s3LastChange;
+  snap.sensorVec     = sensorVec;
+  memcpy(snap.triggerCount, triggerCount, sizeof(triggerCount));
+  memcpy(snap.frame, ledFrame, sizeof(ledFrame));
+#if AUTO_HOLD_TUNING
+  memcpy(snap.gapHist, gapHist, sizeof(gapHist));
+  snap.gapSamples      = gapSamples;
+  snap.lastTriggerTime = lastTriggerTime;
+  snap.haveLastTrigger = haveLastTrigger;
+  snap.holdLearnedMs   = holdLearnedMs.count;
+#endif
+#if ISR_SAMPLER
+  noInterrupts();                  // Timer2 updates all three together
+  memcpy(snap.samplerHist, samplerHist, sizeof(samplerHist));
+  memcpy(snap.samplerLevel, samplerLevel, sizeof(samplerLevel));
+  snap.sampledVec = sampledVec;
+  interrupts();
+#endif
+#if MODBUS_SLAVE
+  snap.forceMode     = (uint8_t)forceMode;
+#endif
+#if HOLD_WARNING
+  snap.s1HoldExtend  = s1HoldExtend;
+#endif
+#if GESTURES
+  memcpy(snap.gestures, gestures, sizeof(gestures));
+  snap.holdLatched   = holdLatched;
+  snap.trigSuppress  = trigSuppress;
+#endif
+#if CONFIG_RELOAD
+  snap.stepMsMasterCfg = stepMsMasterCfg;
+  snap.stepMsS2S3Cfg   = stepMsS2S3Cfg;
+  snap.s1TopDwellMs    = Ms(s1TopDwellMs).count;
+  snap.debounceMs      = debounceMs;
+  memcpy(snap.fusionLUT, fusionLUT, sizeof(fusionLUT));
+#endif
+#if RTC_SCHEDULE
+  snap.stepScale16   = stepScale16;
+  snap.holdScale16   = holdScale16;
+  snap.dayLevel      = dayLevel;
+  snap.dayPhase      = dayPhase;
+#endif
+}
+
+void restoreSnapshot(const ControllerSnapshot &snap) {
+  state         = (State)snap.state;
+  currentLed    = snap.currentLed;
+  lastStepTime  = MsTime(snap.lastStepTime);
+  holdStartTime = MsTime(snap.holdStartTime);
+  holdS2S3BaseMs = Ms(snap.holdS2S3BaseMs);
+  holdS1BaseMs   = Ms(snap.holdS1BaseMs);
+  s1Released    = snap.s1Released;
+  s1Stable      = snap.stable[0];     s2Stable     = snap.stable[1];     s3Stable     = snap.stable[2];
+  s1LastRead    = snap.lastRead[0];   s2LastRead   = snap.lastRead[1];   s3LastRead   = snap.lastRead[2];
+  s1LastChange  = snap.lastChange[0]; s2LastChange = snap.lastChange[1]; s3LastChange = snap.lastChange[2];
+#if !ISR_SAMPLER
+  debSettling   = true;             // take the full debounce path on the next pass
+#endif
+  sensorVec     = snap.sensorVec;
+  memcpy(triggerCount, snap.triggerCount, sizeof(triggerCount));
+#if AUTO_HOLD_TUNING
+  memcpy(gapHist, snap.gapHist, sizeof(gapHist));
+  gapSamples      = snap.gapSamples;
+  lastTriggerTime = snap.lastTriggerTime;
+  haveLastTrigger = snap.haveLastTrigger;
+  holdLearnedMs   = Ms(snap.holdLearnedMs);
+#endif
+#if ISR_SAMPLER
+  noInterrupts();
+  memcpy(samplerHist, snap.samplerHist, sizeof(samplerHist));
+  memcpy(samplerLevel, snap.samplerLevel, sizeof(samplerLevel));
+  sampledVec = snap.sampledVec;
+  interrupts();
+#endif
+#if MODBUS_SLAVE
+  forceMode     = (ForceMode)snap.forceMode;
+#endif
+#if HOLD_WARNING
+  s1HoldExtend  = snap.s1HoldExtend;
+#endif
+#if GESTURES
+  memcpy(gestures, snap.gestures, sizeof(gestures));
+  holdLatched   = snap.holdLatched;
+  trigSuppress  = snap.trigSuppress;
+#endif
+#if CONFIG_RELOAD
+  stepMsMasterCfg = snap.stepMsMasterCfg;
+  stepMsS2S3Cfg   = snap.stepMsS2S3Cfg;
+  s1TopDwellMs    = Ms(snap.s1TopDwellMs);
+  debounceMs      = snap.debounceMs;
+  memcpy(fusionLUT, snap.fusionLUT, sizeof(fusionLUT));
+#if ISR_SAMPLER
+  samplerSetTiming();
+#endif
+#endif
+#if RTC_SCHEDULE
+  stepScale16   = snap.stepScale16;
+  holdScale16   = snap.holdScale16;
+  dayLevel      = snap.dayLevel;
+  dayPhase      = snap.dayPhase;
+#if !HOLD_WARNING
+  setBarLevel(dayLevel);
+#endif
+#endif
+  holdRecompute();
+  for (int i = 0; i < numLeds; i++) {
+    writeLed(i, snap.frame[i >> 3] & (1 << (i & 7)));
+  }
+}
+
+// ------------- Invariants / coverage -------------
+// Hardware-free checks for state-space exploration: checkInvariants() verifies the
+// framebuffer matches what the FSM state implies (returns 0, or the offending state + 1);
+// coverageKey() packs (state, currentLed, s1Released, sensors) for dedup/coverage.
+inline bool ledIsOn(int idx) {
+  return ledFrame[idx >> 3] & (1 << (idx & 7));
+}
+
+// LEDs [0, split) must read `low`, [split, numLeds) must read !low
+bool ledsSplitAt(int split, bool low) {
+  for (int i = 0; i < numLeds; i++) {
+    if (ledIsOn(i) != (i < split ? low : !low)) return false;
+  }
+  return true;
+}
+
+int checkInvariants() {
+#if MODBUS_SLAVE
+  if (forceMode != FORCE_AUTO) return 0;
+#endif
+  bool ok;
+  switch (state) {
+    case IDLE:                 ok = ledsSplitAt(numLeds, false); break;
+    case S1_SWEEP_ON:
+    case S1_FINISH_ON_TO_HOLD:
+    case S2_TURNING_ON:        ok = currentLed >= 0 && currentLed < numLeds && ledsSplitAt(currentLed, true); break;
+    case S3_TURNING_ON:        ok = currentLed >= 0 && currentLed < numLeds && ledsSplitAt(currentLed + 1, false); break;
+    case S1_PEAK_DWELL:
+    case S1_OFF_INSTANT:
+    case S1_HOLD_ON:
+    case S2_HOLD_ON:
+    case S3_HOLD_ON:           ok = ledsSplitAt(numLeds, true); break;
+    case S1_TURNING_OFF_REV:
+    case S2_TURNING_OFF:       ok = currentLed >= 0 && currentLed < numLeds && ledsSplitAt(currentLed + 1, true); break;
+    case S3_TURNING_OFF:       ok = currentLed >= 0 && currentLed < numLeds && ledsSplitAt(currentLed, false); break;
+    default:                   ok = false; break;
+  }
+  return ok ? 0 : (int)state + 1;
+}
+
+uint32_t coverageKey() {
+  uint32_t k = (uint32_t)state * (numLeds + 2) + (uint32_t)(currentLed + 1);
+  return (k << 4) | (s1Released ? 0x08 : 0) | sensorVec;
+}
+
+// ------------- State handlers -------------
+// One function per FSM state, called once per loop() pass with the fused trigger
+// vector. fsmDispatch() picks the handler the way FSM_DISPATCH asks; the handlers
+// are identical across variants, so only the dispatch cost changes.
+const uint8_t TRIG_S1 = 0x01;      // bits of the fusionLUT[] trigger vector
+const uint8_t TRIG_S2 = 0x02;
+const uint8_t TRIG_S3 = 0x04;
+
+typedef void (*StateHandler)(MsTime now, uint8_t trig);
+
+// --- S1: restart the run from all OFF (retrigger during hold / reverse-off) ---
+void s1Restart(MsTime now) {
+  s1Released = false;
+#if HOLD_WARNING
+  s1HoldExtend = false;
+#endif
+  allLedsOff();
+  currentLed = 0;
+  lastStepTime = firstStepBase(now, stepMsMaster(0));
+  state = S1_SWEEP_ON;
+}
+
+// --- S1: ON sweep 1->17 ---
+void fsmS1SweepOn(MsTime now, uint8_t trig) {
+  if (now - lastStepTime >= stepMsMaster(currentLed)) {
+    lastStepTime = now;
+    setLed(currentLed, true);
+    currentLed++;
+    if (currentLed >= numLeds) {
+      // Finished ON sweep
+      if (!s1Released && (trig & TRIG_S1)) {
+        // Dwell briefly with all ON so LED 17 is visibly on
+        state = S1_PEAK_DWELL;
+        lastStepTime = now; // reset for dwell
+      } else {
+        // Released during ON sweep: we are now ALL ON -> hold for 30s
         holdStartTime = now;
         state = S1_HOLD_ON;
       }
     }
-    return;
   }
+}
 
-  // --- S1: hold ALL ON for 30 seconds after release ---
-  if (state == S1_HOLD_ON) {
-    // If sensor1 goes HIGH again during hold, immediately resume S1 run
-    if (s1Stable == HIGH) {
-      s1Released = false;
-      allLedsOff();
-      currentLed = 0;
-      lastStepTime = now;
-      state = S1_SWEEP_ON;
-      return;
+// --- S1: peak dwell at "all ON" before OFF ---
+void fsmS1PeakDwell(MsTime now, uint8_t trig) {
+  if (now - lastStepTime >= s1TopDwellMs) {
+    if (!s1Released && (trig & TRIG_S1)) {
+      // After brief dwell, do the OFF phase and repeat
+      state = S1_OFF_INSTANT;
+    } else {
+      // If released by now, go to the 30s hold with all LEDs ON
+      holdStartTime = now;
+      state = S1_HOLD_ON;
     }
-    // Hold for 30 seconds
-    if (now - holdStartTime >= HOLD_S1_MS) {
-      // Then reverse off 17->1
-      currentLed = numLeds - 1;
-      lastStepTime = now;
-      state = S1_TURNING_OFF_REV;
+  }
+}
+
+// --- S1: turn all OFF instantly (single shot) ---
+void fsmS1OffInstant(MsTime now, uint8_t trig) {
+  allLedsOff();
+  if (!s1Released && (trig & TRIG_S1)) {
+    // Continue the run: start another ON sweep
+    currentLed = 0;
+    lastStepTime = now;
+    state = S1_SWEEP_ON;
+  } else {
+    // Released during/at this OFF phase:
+    // finish sequence -> ensure ALL ON, then hold 30s, then reverse OFF
+    currentLed = 0;
+    lastStepTime = now;
+    state = S1_FINISH_ON_TO_HOLD; // do one more ON sweep to get to ALL ON
+  }
+}
+
+// --- S1: finish to ALL ON (after release) ---
+void fsmS1FinishOnToHold(MsTime now, uint8_t) {
+  if (now - lastStepTime >= stepMsMaster(currentLed)) {
+    lastStepTime = now;
+    setLed(currentLed, true);
+    currentLed++;
+    if (currentLed >= numLeds) {
+      holdStartTime = now;
+      state = S1_HOLD_ON;
     }
-    return;
   }
+}
 
-  // --- S1: reverse OFF 17->1 after hold ---
-  if (state == S1_TURNING_OFF_REV) {
-    // If sensor1 goes HIGH during reverse-off, immediately resume the S1 run
-    if (s1Stable == HIGH) {
-      s1Released = false;
-      allLedsOff();
-      currentLed = 0;
-      lastStepTime = now;
-      state = S1_SWEEP_ON;
+// --- S1: hold ALL ON for 30 seconds after release ---
+void fsmS1HoldOn(MsTime now, uint8_t trig) {
+  // If sensor1 goes HIGH again during hold, immediately resume S1 run
+  if (trig & TRIG_S1) {
+#if HOLD_WARNING
+    // ...unless the bar is already warning: then just extend the hold
+    if (s1HoldExtend || holdInWarning(now)) {
+      s1HoldExtend = true;
+      holdStartTime = now;
       return;
     }
-    if (now - lastStepTime >= STEP_MS_MASTER) {
-      lastStepTime = now;
-      setLed(currentLed, false);
-      currentLed--;
-      if (currentLed < 0) {
-        resetToIdle();
-      }
-    }
+#endif
+    s1Restart(now);
+    fsmS1SweepOn(now, trig);
     return;
   }
-  // ====================== END SENSOR 1 (MASTER) ======================
-
-  // ----- IDLE: accept S2/S3 triggers -----
-  if (state == IDLE) {
-    if (s2Stable == HIGH) {
-      // Start Sensor2 sequence: ON 1->17
-      state = S2_TURNING_ON;
-      currentLed = 0;           // first LED index
-      lastStepTime = now;
-      allLedsOff();
-    } else if (s3Stable == HIGH) {
-      // Start Sensor3 sequence: ON 17->1
-      state = S3_TURNING_ON;
-      currentLed = numLeds - 1; // start from last LED
-      lastStepTime = now;
-      allLedsOff();
-    } else {
-      // remain idle
+#if HOLD_WARNING
+  s1HoldExtend = false;
+#endif
+  // Hold for 30 seconds
+  if (now - holdStartTime >= holdS1Ms) {
+    // Then reverse off 17->1
+    currentLed = numLeds - 1;
+    lastStepTime = now;
+    state = S1_TURNING_OFF_REV;
+  }
+}
+
+// --- S1: reverse OFF 17->1 after hold ---
+void fsmS1TurningOffRev(MsTime now, uint8_t trig) {
+  // If sensor1 goes HIGH during reverse-off, immediately resume the S1 run
+  if (trig & TRIG_S1) {
+    s1Restart(now);
+    fsmS1SweepOn(now, trig);
+    return;
+  }
+  if (now - lastStepTime >= stepMsMaster(numLeds - 1 - currentLed)) {
+    lastStepTime = now;
+    setLed(currentLed, false);
+    currentLed--;
+    if (currentLed < 0) {
+      resetToIdle();
     }
   }
+}
 
-  // ----- Sensor 2 sequence -----
-  if (state == S2_TURNING_ON) {
-    if (now - lastStepTime >= STEP_MS_S2_S3) {
-      lastStepTime = now;
-      setLed(currentLed, true);
-      currentLed++;
-      if (currentLed >= numLeds) {
-        // fully ON
-        holdStartTime = now;
-        state = S2_HOLD_ON;
-      }
+// ----- Sensor 2 sequence -----
+void fsmS2TurningOn(MsTime now, uint8_t) {
+  if (now - lastStepTime >= stepMsS2S3(currentLed)) {
+    lastStepTime = now;
+    setLed(currentLed, true);
+    currentLed++;
+    if (currentLed >= numLeds) {
+      // fully ON
+      holdStartTime = now;
+      state = S2_HOLD_ON;
     }
-  } else if (state == S2_HOLD_ON) {
-    // Retrigger resets hold timer
-    if (s2Stable == HIGH) holdStartTime = now;
-    if (now - holdStartTime >= HOLD_DURATION_MS) {
-      // start turning off reverse: 17->1
-      state = S2_TURNING_OFF;
-      currentLed = numLeds - 1;
-      lastStepTime = now;
+  }
+}
+
+void fsmS2HoldOn(MsTime now, uint8_t trig) {
+  // Retrigger resets hold timer
+  if (trig & TRIG_S2) holdStartTime = now;
+  if (now - holdStartTime >= holdS2S3Ms) {
+    // start turning off reverse: 17->1
+    state = S2_TURNING_OFF;
+    currentLed = numLeds - 1;
+    lastStepTime = now;
+  }
+}
+
+void fsmS2TurningOff(MsTime now, uint8_t) {
+  if (now - lastStepTime >= stepMsS2S3(numLeds - 1 - currentLed)) {
+    lastStepTime = now;
+    setLed(currentLed, false);
+    currentLed--;
+    if (currentLed < 0) {
+      resetToIdle();
     }
-  } else if (state == S2_TURNING_OFF) {
-    if (now - lastStepTime >= STEP_MS_S2_S3) {
-      lastStepTime = now;
-      setLed(currentLed, false);
-      currentLed--;
-      if (currentLed < 0) {
-        resetToIdle();
-      }
+  }
+}
+
+// ----- Sensor 3 sequence -----
+void fsmS3TurningOn(MsTime now, uint8_t) {
+  if (now - lastStepTime >= stepMsS2S3(numLeds - 1 - currentLed)) {
+    lastStepTime = now;
+    setLed(currentLed, true);
+    currentLed--;
+    if (currentLed < 0) {
+      // fully ON
+      holdStartTime = now;
+      state = S3_HOLD_ON;
     }
   }
+}
 
-  // ----- Sensor 3 sequence -----
-  if (state == S3_TURNING_ON) {
-    if (now - lastStepTime >= STEP_MS_S2_S3) {
-      lastStepTime = now;
-      setLed(currentLed, true);
-      currentLed--;
-      if (currentLed < 0) {
-        // fully ON
-        holdStartTime = now;
-        state = S3_HOLD_ON;
-      }
+void fsmS3HoldOn(MsTime now, uint8_t trig) {
+  // Retrigger resets hold timer
+  if (trig & TRIG_S3) holdStartTime = now;
+  if (now - holdStartTime >= holdS2S3Ms) {
+    // start turning off normal: 1->17
+    state = S3_TURNING_OFF;
+    currentLed = 0;
+    lastStepTime = now;
+  }
+}
+
+void fsmS3TurningOff(MsTime now, uint8_t) {
+  if (now - lastStepTime >= stepMsS2S3(currentLed)) {
+    lastStepTime = now;
+    setLed(currentLed, false);
+    currentLed++;
+    if (currentLed >= numLeds) {
+      resetToIdle();
     }
-  } else if (state == S3_HOLD_ON) {
-    // Retrigger resets hold timer
-    if (s3Stable == HIGH) holdStartTime = now;
-    if (now - holdStartTime >= HOLD_DURATION_MS) {
-      // start turning off normal: 1->17
-      state = S3_TURNING_OFF;
-      currentLed = 0;
-      lastStepTime = now;
+  }
+}
+
+// ----- IDLE: accept S2/S3 triggers -----
+// A new sequence takes its first step in the same pass, as it always has.
+void fsmIdle(MsTime now, uint8_t trig) {
+  if (trig & TRIG_S2) {
+    // Start Sensor2 sequence: ON 1->17
+    state = S2_TURNING_ON;
+    currentLed = 0;           // first LED index
+    lastStepTime = firstStepBase(now, stepMsS2S3(0));
+    allLedsOff();
+    fsmS2TurningOn(now, trig);
+  } else if (trig & TRIG_S3) {
+    // Start Sensor3 sequence: ON 17->1
+    state = S3_TURNING_ON;
+    currentLed = numLeds - 1; // start from last LED
+    lastStepTime = firstStepBase(now, stepMsS2S3(0));
+    allLedsOff();
+    fsmS3TurningOn(now, trig);
+  }
+}
+
+#if FSM_DISPATCH == FSM_DISPATCH_TABLE
+// Indexed by State: keep in enum order
+const StateHandler FSM_HANDLERS[] PROGMEM = {
+  fsmIdle,
+  fsmS1SweepOn, fsmS1PeakDwell, fsmS1OffInstant, fsmS1FinishOnToHold, fsmS1HoldOn, fsmS1TurningOffRev,
+  fsmS2TurningOn, fsmS2HoldOn, fsmS2TurningOff,
+  fsmS3TurningOn, fsmS3HoldOn, fsmS3TurningOff
+};
+static_assert(sizeof(FSM_HANDLERS) / sizeof(FSM_HANDLERS[0]) == S3_TURNING_OFF + 1,
+              "FSM_HANDLERS must have one entry per State");
+#endif
+
+inline void fsmDispatch(MsTime now, uint8_t trig) {
+#if FSM_DISPATCH == FSM_DISPATCH_TABLE
+  ((StateHandler)pgm_read_ptr(&FSM_HANDLERS[state]))(now, trig);
+#elif FSM_DISPATCH == FSM_DISPATCH_SWITCH
+  switch (state) {
+    case IDLE:                 fsmIdle(now, trig); break;
+    case S1_SWEEP_ON:          fsmS1SweepOn(now, trig); break;
+    case S1_PEAK_DWELL:        fsmS1PeakDwell(now, trig); break;
+    case S1_OFF_INSTANT:       fsmS1OffInstant(now, trig); break;
+    case S1_FINISH_ON_TO_HOLD: fsmS1FinishOnToHold(now, trig); break;
+    case S1_HOLD_ON:           fsmS1HoldOn(now, trig); break;
+    case S1_TURNING_OFF_REV:   fsmS1TurningOffRev(now, trig); break;
+    case S2_TURNING_ON:        fsmS2TurningOn(now, trig); break;
+    case S2_HOLD_ON:           fsmS2HoldOn(now, trig); break;
+    case S2_TURNING_OFF:       fsmS2TurningOff(now, trig); break;
+    case S3_TURNING_ON:        fsmS3TurningOn(now, trig); break;
+    case S3_HOLD_ON:           fsmS3HoldOn(now, trig); break;
+    case S3_TURNING_OFF:       fsmS3TurningOff(now, trig); break;
+  }
+#else
+  if (state == S1_SWEEP_ON)               fsmS1SweepOn(now, trig);
+  else if (state == S1_PEAK_DWELL)        fsmS1PeakDwell(now, trig);
+  else if (state == S1_OFF_INSTANT)       fsmS1OffInstant(now, trig);
+  else if (state == S1_FINISH_ON_TO_HOLD) fsmS1FinishOnToHold(now, trig);
+  else if (state == S1_HOLD_ON)           fsmS1HoldOn(now, trig);
+  else if (state == S1_TURNING_OFF_REV)   fsmS1TurningOffRev(now, trig);
+  else if (state == IDLE)                 fsmIdle(now, trig);
+  else if (state == S2_TURNING_ON)        fsmS2TurningOn(now, trig);
+  else if (state == S2_HOLD_ON)           fsmS2HoldOn(now, trig);
+  else if (state == S2_TURNING_OFF)       fsmS2TurningOff(now, trig);
+  else if (state == S3_TURNING_ON)        fsmS3TurningOn(now, trig);
+  else if (state == S3_HOLD_ON)           fsmS3HoldOn(now, trig);
+  else if (state == S3_TURNING_OFF)       fsmS3TurningOff(now, trig);
+#endif
+}
+
+// ------------- Arduino setup/loop -------------
+void setup() {
+#if MEMORY_STATS
+  stackPaint();
+#endif
+#if TELEMETRY || CONFIG_RELOAD || HISTORY
+  Serial.begin(SERIAL_BAUD);
+#endif
+  LedOutput::begin();
+
+  // Using INPUT based on your wiring (you said hardware provides proper levels)
+  pinMode(sensor1Pin, INPUT);
+  pinMode(sensor2Pin, INPUT);
+  pinMode(sensor3Pin, INPUT);
+  sensorPinsBegin();
+
+#if MODBUS_SLAVE
+  modbusBegin();
+#endif
+#if LATENCY_MEASURE
+  latencyBegin();
+#endif
+#if RTC_SCHEDULE
+  rtcBegin();
+#endif
+#if ISR_SAMPLER
+  samplerBegin();
+#endif
+}
+
+void loop() {
+  unsigned long now = millis();
+
+#if CONFIG_RELOAD || HISTORY
+  serialPoll();
+#endif
+#if CONFIG_RELOAD
+  configApply();
+#endif
+
+  // Debounce all sensors
+#if ISR_SAMPLER
+  uint8_t sampled = sampledVec;
+  s1Stable = (sampled & 0x01) ? HIGH : LOW;
+  s2Stable = (sampled & 0x02) ? HIGH : LOW;
+  s3Stable = (sampled & 0x04) ? HIGH : LOW;
+#else
+  debounceAll(now);
+#endif
+  updateSensorEdges();
+
+#if GESTURES
+  updateGestures(now);
+  if (holdLatched && (state == S1_HOLD_ON || state == S2_HOLD_ON || state == S3_HOLD_ON)) {
+    holdStartTime = MsTime(now);
+  }
+#endif
+
+  // Logical triggers the FSM acts on
+#if GESTURES
+  uint8_t trig = fusionLUT[sensorVec & ~trigSuppress];
+#else
+  uint8_t trig = fusionLUT[sensorVec];
+#endif
+#if AUTO_HOLD_TUNING
+  if (sensorRose) recordTriggerGap(now);
+#endif
+
+#if TELEMETRY
+  statusReport(now);
+#endif
+#if TELEMETRY && TRACE
+  traceUpdate(now);
+#endif
+#if HISTORY
+  historyUpdate(now);
+  historyDumpStep();
+#endif
+#if MEMORY_STATS
+  stackScanStep();
+  memoryReport(now);
+#endif
+#if LATENCY_MEASURE
+  latencyUpdate(now);
+#endif
+
+#if RTC_SCHEDULE
+  rtcPoll(now);
+#endif
+#if HOLD_WARNING
+  holdWarningService(now);
+#endif
+
+#if MODBUS_SLAVE
+  modbusPoll();
+  if (forceMode != FORCE_AUTO) {         // BMS override: sequencing suspended
+    LedOutput::service();
+    return;
+  }
+#endif
+
+  // ========================= SENSOR 1 (MASTER) =========================
+  // Start or maintain S1 while pin is HIGH
+  if (trig & TRIG_S1) {
+    if (!(state == S1_SWEEP_ON || state == S1_PEAK_DWELL || state == S1_OFF_INSTANT ||
+          state == S1_HOLD_ON || state == S1_TURNING_OFF_REV)) {
+      // Take control if not already in the S1 running states or post-release phases
+      // (those handle their own retrigger: restart, or extend a warning hold)
+      s1Restart(MsTime(now));
     }
-  } else if (state == S3_TURNING_OFF) {
-    if (now - lastStepTime >= STEP_MS_S2_S3) {
-      lastStepTime = now;
-      setLed(currentLed, false);
-      currentLed++;
-      if (currentLed >= numLeds) {
-        resetToIdle();
-      }
+  } else {
+    // s1 is LOW: if we are in running S1 states, mark release so we finish sequence
+    if (state == S1_SWEEP_ON || state == S1_PEAK_DWELL || state == S1_OFF_INSTANT) {
+      s1Released = true;
     }
   }
+
+  fsmDispatch(MsTime(now), trig);
+  LedOutput::service();                  // push this pass's frame out
 }
\ No newline at end of file
@@ -0,0 +1,36 @@
+// Host stub of the Arduino core: see Arduino.h
+#include "Arduino.h"
+
+unsigned long hostMicros = 0;
+uint8_t hostPinIn[HOST_PINS];
+static HostPins defaultBank;
+HostPins *hostBank = &defaultBank;
+
+HardwareSerial Serial;
+
+#define HOST_DEF8(n)  volatile uint8_t n;
+#define HOST_DEF16(n) volatile uint16_t n;
+HOST_REGS(HOST_DEF8, HOST_DEF16)
+volatile uintptr_t SP;
+
+unsigned long millis() {
+  return hostMicros / 1000;
+}
+
+unsigned long micros() {
+  return hostMicros;
+}
+
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  hostBank->out[pin] = val ? 1 : 0;
+}
+
+int digitalRead(uint8_t pin) {
+  return hostPinIn[pin] ? HIGH : LOW;
+}
+
+void analogWrite(uint8_t pin, int val) {
+  hostBank->out[pin] = val > 127 ? 1 : 0;
+}
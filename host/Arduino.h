@@ -0,0 +1,173 @@
+/* --------------------------
+   Host stub of the Arduino/AVR API: just enough to build the sketch on a PC.
+   - Time is hostMicros, set by the driver; millis() = hostMicros / 1000.
+   - Every pin is its own "port" with bit mask 1, so digitalRead() and the cached
+     portInputRegister() reads both see hostPinIn[pin], and digitalWrite() and
+     portOutputRegister() writes both land in hostBank->out[pin].
+   - hostBank is switched by the driver, so two engines built into one binary
+     (see lockstep.cpp) each drive their own set of output pins.
+   - AVR peripheral registers are plain globals; ISR(v) defines an ordinary
+     function the driver can call to simulate the interrupt.
+--------------------------- */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define F_CPU 16000000UL
+
+typedef uint8_t byte;
+
+// ------------- Host side -------------
+const int HOST_PINS = 70;                  // Mega 2560 digital pins
+
+struct HostPins {
+  uint8_t out[HOST_PINS];
+};
+
+extern unsigned long hostMicros;
+extern uint8_t hostPinIn[HOST_PINS];
+extern HostPins *hostBank;
+
+inline void hostSetInput(int pin, bool high) {
+  hostPinIn[pin] = high ? 1 : 0;
+}
+
+// ------------- Core API -------------
+unsigned long millis();
+unsigned long micros();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#define digitalPinToPort(p)     (p)
+#define digitalPinToBitMask(p)  ((uint8_t)1)
+#define portInputRegister(p)    (&hostPinIn[(p)])
+#define portOutputRegister(p)   (&hostBank->out[(p)])
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_ptr(p)  (*(void * const *)(p))
+
+#define ISR(v) void v(void)
+#define _BV(b) (1u << (b))
+
+// Serial: received bytes are queued by the driver, transmitted bytes are captured
+struct HardwareSerial {
+  uint8_t rx[256];
+  uint8_t rxHead, rxTail;
+  uint8_t tx[4096];
+  size_t txLen;
+
+  void begin(unsigned long) {}
+  int available() { return (uint8_t)(rxTail - rxHead); }
+  int read() { return rxHead == rxTail ? -1 : rx[rxHead++]; }
+  int availableForWrite() { return 63; }
+  size_t write(uint8_t b) {
+    if (txLen < sizeof(tx)) tx[txLen++] = b;
+    return 1;
+  }
+  size_t write(const uint8_t *buf, size_t n) {
+    for (size_t i = 0; i < n; i++) write(buf[i]);
+    return n;
+  }
+  void feed(const uint8_t *buf, size_t n) {
+    for (size_t i = 0; i < n; i++) rx[rxTail++] = buf[i];
+  }
+};
+extern HardwareSerial Serial;
+
+// ------------- AVR registers -------------
+#define HOST_REG8(n)  extern volatile uint8_t n;
+#define HOST_REG16(n) extern volatile uint16_t n;
+#define HOST_REGS(R8, R16) \
+  R8(SREG) R8(PORTA) R8(DDRA) R8(PINA) R8(PORTC) R8(DDRC) R8(PINC) R8(PORTL) R8(DDRL) R8(PINL) \
+  R8(TCCR1A) R8(TCCR1B) R8(TCCR2A) R8(TCCR2B) R8(OCR2A) R8(TIMSK2) \
+  R8(TCCR3A) R8(TCCR3B) R8(TIMSK3) R8(TCCR4A) R8(TCCR4B) R8(TIMSK4) \
+  R8(TCCR5A) R8(TCCR5B) R8(TIMSK5) \
+  R8(UCSR1A) R8(UCSR1B) R8(UCSR1C) R8(UDR1) R8(UCSR2A) R8(UCSR2B) R8(UCSR2C) R8(UDR2) \
+  R8(TWBR) R8(TWSR) R8(TWCR) R8(TWDR) R8(SPCR) R8(SPSR) R8(SPDR) \
+  R16(OCR1A) R16(OCR3A) R16(OCR4A) R16(OCR4B) R16(OCR5A) R16(OCR5B) \
+  R16(TCNT1) R16(TCNT3) R16(TCNT4) R16(TCNT5) R16(UBRR1) R16(UBRR2)
+HOST_REGS(HOST_REG8, HOST_REG16)
+extern volatile uintptr_t SP;             // pointer-wide so (uint8_t *)SP builds cleanly
+
+// Register bits (ATmega2560 datasheet)
+#define WGM12 3
+#define WGM21 1
+#define WGM32 3
+#define WGM42 3
+#define WGM52 3
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define CS30 0
+#define CS31 1
+#define CS32 2
+#define CS40 0
+#define CS41 1
+#define CS42 2
+#define CS50 0
+#define CS51 1
+#define CS52 2
+#define OCIE1A 1
+#define OCIE2A 1
+#define OCIE3A 1
+#define OCIE4A 1
+#define OCIE4B 2
+#define OCIE5A 1
+#define OCIE5B 2
+#define RXC1 7
+#define TXC1 6
+#define UDRE1 5
+#define FE1 4
+#define U2X1 1
+#define RXCIE1 7
+#define TXCIE1 6
+#define UDRIE1 5
+#define RXEN1 4
+#define TXEN1 3
+#define USBS1 3
+#define UPM11 5
+#define UCSZ11 2
+#define UCSZ10 1
+#define RXC2 7
+#define TXC2 6
+#define UDRE2 5
+#define FE2 4
+#define DOR2 3
+#define UPE2 2
+#define U2X2 1
+#define RXCIE2 7
+#define TXCIE2 6
+#define UDRIE2 5
+#define RXEN2 4
+#define TXEN2 3
+#define UPM21 5
+#define UPM20 4
+#define USBS2 3
+#define UCSZ21 2
+#define UCSZ20 1
+#define TWINT 7
+#define TWEA 6
+#define TWSTA 5
+#define TWSTO 4
+#define TWEN 2
+#define SPE 6
+#define MSTR 4
+#define SPIF 7
+#define SPI2X 0
@@ -0,0 +1,17 @@
+#!/bin/sh
+# usage: configure.sh SRC OUT [NAME[=VALUE] ...]
+# Copy the sketch to OUT with the given compile-time switches set (VALUE defaults to 1).
+src=$1
+out=$2
+shift 2
+cp "$src" "$out" || exit 1
+for f in "$@"; do
+  n=${f%%=*}
+  v=${f#*=}
+  [ "$n" = "$f" ] && v=1
+  if ! grep -q "^#define $n " "$out"; then
+    echo "configure.sh: no switch $n in $src" >&2
+    exit 1
+  fi
+  sed "s/^#define $n .*/#define $n $v/" "$out" > "$out.tmp" && mv "$out.tmp" "$out"
+done
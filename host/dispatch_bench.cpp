@@ -0,0 +1,84 @@
+/* --------------------------
+   FSM dispatch benchmark: the sketch is built three times, once per FSM_DISPATCH
+   variant (if-chain, switch, PROGMEM table), and fsmDispatch() is timed in each of the
+   13 states. Every call starts from the same state with no step due and no trigger,
+   so the handler work is the same in all three variants and the difference is the
+   dispatch itself. Numbers are host nanoseconds: use them to rank the variants, not as
+   AVR cycle counts.
+
+   usage: dispatch_bench [calls-per-state]
+--------------------------- */
+#include "Arduino.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+namespace v_if {
+#include "dispatch0.cpp"
+}
+
+#undef FSM_DISPATCH                // each copy sets its own
+namespace v_switch {
+#include "dispatch1.cpp"
+}
+
+#undef FSM_DISPATCH
+namespace v_table {
+#include "dispatch2.cpp"
+}
+
+const int NUM_STATES = v_switch::S3_TURNING_OFF + 1;
+const int REPEATS = 5;
+
+const char *const STATE_NAMES[NUM_STATES] = {
+  "IDLE",
+  "S1_SWEEP_ON", "S1_PEAK_DWELL", "S1_OFF_INSTANT", "S1_FINISH_ON_TO_HOLD", "S1_HOLD_ON", "S1_TURNING_OFF_REV",
+  "S2_TURNING_ON", "S2_HOLD_ON", "S2_TURNING_OFF",
+  "S3_TURNING_ON", "S3_HOLD_ON", "S3_TURNING_OFF",
+};
+
+// Best of REPEATS runs of `calls` dispatches in state s, in ns per call
+#define BENCH_VARIANT(ns)                                                           \
+  double bench_##ns(int s, unsigned long calls) {                                   \
+    using namespace ns;                                                             \
+    MsTime now(1000000UL);                                                          \
+    double best = 1e30;                                                             \
+    for (int r = 0; r < REPEATS; r++) {                                             \
+      auto t0 = std::chrono::steady_clock::now();                                   \
+      for (unsigned long i = 0; i < calls; i++) {                                   \
+        state = (State)s;                                                           \
+        currentLed = 0;                                                             \
+        lastStepTime = now;                                                         \
+        holdStartTime = now;                                                        \
+        fsmDispatch(now, 0);                                                        \
+      }                                                                             \
+      auto t1 = std::chrono::steady_clock::now();                                   \
+      double per = std::chrono::duration<double, std::nano>(t1 - t0).count() / calls; \
+      if (per < best) best = per;                                                   \
+    }                                                                               \
+    return best;                                                                    \
+  }
+
+BENCH_VARIANT(v_if)
+BENCH_VARIANT(v_switch)
+BENCH_VARIANT(v_table)
+
+int main(int argc, char **argv) {
+  unsigned long calls = argc > 1 ? strtoul(argv[1], 0, 10) : 2000000UL;
+
+  v_if::setup();
+  v_switch::setup();
+  v_table::setup();
+
+  double total[3] = {0, 0, 0};
+  printf("%-22s %8s %8s %8s   (ns per fsmDispatch)\n", "state", "if", "switch", "table");
+  for (int s = 0; s < NUM_STATES; s++) {
+    double t[3] = {bench_v_if(s, calls), bench_v_switch(s, calls), bench_v_table(s, calls)};
+    printf("%-22s %8.2f %8.2f %8.2f\n", STATE_NAMES[s], t[0], t[1], t[2]);
+    for (int k = 0; k < 3; k++) total[k] += t[k];
+  }
+  printf("%-22s %8.2f %8.2f %8.2f\n", "mean", total[0] / NUM_STATES, total[1] / NUM_STATES,
+         total[2] / NUM_STATES);
+  return 0;
+}
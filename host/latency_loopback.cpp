@@ -0,0 +1,66 @@
+/* --------------------------
+   Latency loopback: the LATENCY_MEASURE build is driven the way the hardware drives it.
+   Time advances in 250 us steps. loop() runs every step, the Timer5 sampler ISR every
+   other step (LATENCY_SAMPLE_HZ = 2 kHz) and, under ISR_SAMPLER, the Timer2 sampler
+   every fourth. Each trial waits for IDLE, raises Sensor 2 at a random step, releases
+   it and lets the sequence finish. The sketch's own histogram is then checked: every
+   trial must have produced a sample, and latencyPercentileMs(99) must be within the
+   budget.
+
+   usage: latency_loopback [p99-budget-ms] [trials] [seed]
+--------------------------- */
+#include "Arduino.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "loopback.cpp"
+
+const unsigned long STEP_US = 250;
+const int S2_PIN = 11;
+
+unsigned long stepNo = 0;
+
+void step() {
+  hostMicros = stepNo * STEP_US;
+  if (stepNo % 2 == 0) TIMER5_COMPA_vect();
+#if ISR_SAMPLER
+  if (stepNo % 4 == 0) TIMER2_COMPA_vect();        // 1 kHz
+#endif
+  loop();
+  stepNo++;
+}
+
+int main(int argc, char **argv) {
+  unsigned int budgetMs = argc > 1 ? atoi(argv[1]) : 80;
+  int trials = argc > 2 ? atoi(argv[2]) : 100;
+  uint32_t rng = argc > 3 ? strtoul(argv[3], 0, 10) : 1;
+
+  hostSetInput(S2_PIN, false);
+  setup();
+  for (int n = 0; n < trials; n++) {
+    while (state != IDLE) step();
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    for (uint32_t k = rng % 400; k > 0; k--) step();   // 0..100 ms, any sampler phase
+    hostSetInput(S2_PIN, true);
+    for (int k = 0; k < 1200; k++) step();              // 300 ms, well past the debounce
+    hostSetInput(S2_PIN, false);
+  }
+  while (state != IDLE) step();
+
+  unsigned int p50 = latencyPercentileMs(50), p90 = latencyPercentileMs(90);
+  unsigned int p99 = latencyPercentileMs(99);
+  printf("latency loopback: %u samples, p50 %u ms, p90 %u ms, p99 %u ms, max %lu us (budget p99 <= %u ms)\n",
+         latCount, p50, p90, p99, latMaxUs, budgetMs);
+  if (latCount != (unsigned)trials) {
+    printf("FAIL: %d edges injected, %u measured\n", trials, latCount);
+    return 1;
+  }
+  if (p99 > budgetMs) {
+    printf("FAIL: p99 over budget\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,186 @@
+/* --------------------------
+   Differential lockstep test: the baseline loop() and the current (candidate) sketch
+   run side by side on the same random sensor stream, one loop() each per 1 ms tick,
+   and their 17 LED pins are compared after every tick.
+   Each seed runs in a forked child, so both engines start from fresh static state.
+   On a divergence the event list is shrunk (drop chunks while it still diverges)
+   and the minimal stream is printed with the first differing tick.
+
+   usage: lockstep [seeds] [ticks] [first-seed]
+--------------------------- */
+#include "Arduino.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+
+namespace base {
+#include "baseline.cpp"
+}
+
+namespace cand {
+#include "candidate.cpp"
+}
+
+struct Event {
+  unsigned long tick;
+  uint8_t sensor;          // 0..2 = S1..S3
+  uint8_t level;
+};
+
+const int SENSOR_PINS[3] = {9, 11, 7};
+
+struct Engine {
+  HostPins pins;
+  void (*setup)();
+  void (*loop)();
+  const int *ledPins;
+  int numLeds;
+
+  uint32_t mask() const {
+    uint32_t m = 0;
+    for (int i = 0; i < numLeds; i++) {
+      if (pins.out[ledPins[i]]) m |= 1UL << i;
+    }
+    return m;
+  }
+};
+
+// xorshift32: fast and identical on every host
+struct Rng {
+  uint32_t s;
+  uint32_t next() {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+  }
+};
+
+// Sensor activity: mostly long quiet gaps, with bursts, glitches shorter than the
+// debounce time and long holds mixed in
+std::vector<Event> makeEvents(uint32_t seed, unsigned long ticks) {
+  std::vector<Event> ev;
+  Rng r = {seed * 2654435761u + 1};
+  uint8_t level[3] = {0, 0, 0};
+  for (unsigned long t = 1; t < ticks; t++) {
+    uint32_t x = r.next();
+    if (x % 4000 == 0) {
+      uint8_t s = (x >> 12) % 3;
+      level[s] ^= 1;
+      ev.push_back({t, s, level[s]});
+    } else if (x % 20011 == 0) {
+      uint8_t s = (x >> 12) % 3;
+      level[s] = 1;
+      ev.push_back({t, s, 1});
+    }
+  }
+  return ev;
+}
+
+// First tick at which the LED pins differ, or -1
+long runLockstep(const std::vector<Event> &ev, unsigned long ticks, bool verbose) {
+  Engine e[2] = {
+    {HostPins(), base::setup, base::loop, base::ledPins, base::numLeds},
+    {HostPins(), cand::setup, cand::loop, cand::ledPins, cand::numLeds},
+  };
+  for (int i = 0; i < 3; i++) hostSetInput(SENSOR_PINS[i], false);
+  hostMicros = 0;
+  for (int k = 0; k < 2; k++) {
+    hostBank = &e[k].pins;
+    e[k].setup();
+  }
+  size_t next = 0;
+  for (unsigned long t = 0; t < ticks; t++) {
+    while (next < ev.size() && ev[next].tick == t) {
+      hostSetInput(SENSOR_PINS[ev[next].sensor], ev[next].level);
+      next++;
+    }
+    hostMicros = t * 1000UL;
+    for (int k = 0; k < 2; k++) {
+      hostBank = &e[k].pins;
+      e[k].loop();
+    }
+    if (e[0].mask() != e[1].mask()) {
+      if (verbose) {
+        printf("diverged at tick %lu: baseline %05lx, candidate %05lx (state %d, led %d)\n",
+               t, (unsigned long)e[0].mask(), (unsigned long)e[1].mask(),
+               (int)cand::state, cand::currentLed);
+      }
+      return (long)t;
+    }
+  }
+  return -1;
+}
+
+// Same, in a child process so every run starts from the programs' initial state
+long runForked(const std::vector<Event> &ev, unsigned long ticks, bool verbose) {
+  int fd[2];
+  if (pipe(fd) != 0) {
+    perror("pipe");
+    exit(2);
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fd[0]);
+    long r = runLockstep(ev, ticks, verbose);
+    fflush(stdout);
+    if (write(fd[1], &r, sizeof(r)) != (ssize_t)sizeof(r)) _exit(2);
+    _exit(0);
+  }
+  close(fd[1]);
+  long r = -2;
+  if (read(fd[0], &r, sizeof(r)) != (ssize_t)sizeof(r)) r = -2;
+  close(fd[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  if (r == -2) {
+    fprintf(stderr, "lockstep: child failed\n");
+    exit(2);
+  }
+  return r;
+}
+
+// Drop chunks of events (halving the chunk size) as long as the run still diverges
+std::vector<Event> minimize(std::vector<Event> ev, unsigned long ticks) {
+  for (size_t chunk = ev.size() / 2; chunk >= 1; chunk /= 2) {
+    for (size_t i = 0; i < ev.size();) {
+      std::vector<Event> trial(ev.begin(), ev.begin() + i);
+      size_t end = i + chunk < ev.size() ? i + chunk : ev.size();
+      trial.insert(trial.end(), ev.begin() + end, ev.end());
+      if (runForked(trial, ticks, false) >= 0) ev = trial;
+      else i += chunk;
+    }
+  }
+  return ev;
+}
+
+int main(int argc, char **argv) {
+  int seeds = argc > 1 ? atoi(argv[1]) : 4;
+  unsigned long ticks = argc > 2 ? strtoul(argv[2], 0, 10) : 2000000UL;
+  int first = argc > 3 ? atoi(argv[3]) : 1;
+
+  for (int seed = first; seed < first + seeds; seed++) {
+    std::vector<Event> ev = makeEvents(seed, ticks);
+    long t = runForked(ev, ticks, false);
+    if (t < 0) {
+      printf("seed %d: %lu ticks, %u events, identical\n", seed, ticks, (unsigned)ev.size());
+      continue;
+    }
+    printf("seed %d: diverged at tick %ld, minimizing %u events\n", seed, t, (unsigned)ev.size());
+    unsigned long limit = (unsigned long)t + 1;
+    std::vector<Event> events(ev.begin(), ev.end());
+    while (!events.empty() && events.back().tick >= limit) events.pop_back();
+    std::vector<Event> min = minimize(events, limit);
+    printf("minimal input (%u events):\n", (unsigned)min.size());
+    for (size_t i = 0; i < min.size(); i++) {
+      printf("  tick %lu: S%d %s\n", min[i].tick, min[i].sensor + 1, min[i].level ? "HIGH" : "LOW");
+    }
+    runForked(min, limit, true);
+    return 1;
+  }
+  return 0;
+}